@@ -0,0 +1,184 @@
+#define _GNU_SOURCE  // CPU sets and sched_setaffinity
+#include "affinity.h"
+
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int affinity_enabled = 0;
+
+/// A CPU the program may run on.
+struct Cpu {
+  int id;
+  int node;  /// NUMA node of the CPU, 0 when the system does not tell.
+};
+
+static struct Cpu *cpus = NULL;  // Ordered by node, then by id
+static int num_cpus = 0;
+static int num_nodes = 0;
+static int num_groups = 1;
+
+/// Finds the NUMA node of a CPU from the nodeN link sysfs keeps in its directory.
+static int node_of(int cpu) {
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR *dir = opendir(path);
+  if (dir == NULL) return 0;
+
+  int node = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+      node = atoi(entry->d_name + 4);
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+}
+
+static int compare_cpus(const void *a, const void *b) {
+  const struct Cpu *first = (const struct Cpu*)a;
+  const struct Cpu *second = (const struct Cpu*)b;
+
+  if (first->node != second->node) return first->node < second->node ? -1 : 1;
+  return (first->id > second->id) - (first->id < second->id);
+}
+
+int affinity_init(int groups) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    perror("Error reading the CPU affinity");
+    return 1;
+  }
+
+  free(cpus);
+  cpus = malloc((size_t)CPU_COUNT(&set) * sizeof(struct Cpu));
+  if (cpus == NULL) {
+    fprintf(stderr, "Error: Failed to allocate memory\n");
+    return 1;
+  }
+
+  num_cpus = 0;
+  num_nodes = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET((size_t)cpu, &set)) continue;
+
+    cpus[num_cpus].id = cpu;
+    cpus[num_cpus].node = node_of(cpu);
+    if (cpus[num_cpus].node >= num_nodes) num_nodes = cpus[num_cpus].node + 1;
+    num_cpus++;
+  }
+  qsort(cpus, (size_t)num_cpus, sizeof(struct Cpu), compare_cpus);
+
+  num_groups = groups > 0 ? groups : 1;
+  return 0;
+}
+
+/// Gets the CPUs of a group: an even share of the ordered CPUs, or a single one when there are more
+/// groups than CPUs.
+static void group_range(int group, int *first, int *last) {
+  group %= num_groups;
+  if (num_groups > num_cpus) {
+    *first = group % num_cpus;
+    *last = *first + 1;
+    return;
+  }
+  *first = (int)((long)group * num_cpus / num_groups);
+  *last = (int)((long)(group + 1) * num_cpus / num_groups);
+}
+
+/// Prints CPU ids as ranges, such as 0-3,8.
+static void print_cpus(const int *ids, int count) {
+  for (int i = 0; i < count; i++) {
+    int start = i;
+    while (i + 1 < count && ids[i + 1] == ids[i] + 1) i++;
+
+    printf(start == 0 ? "%d" : ",%d", ids[start]);
+    if (i > start) printf("-%d", ids[i]);
+  }
+}
+
+void affinity_report(void) {
+  int *ids = malloc((size_t)(num_cpus > 0 ? num_cpus : 1) * sizeof(int));
+  if (ids == NULL) {
+    fprintf(stderr, "Error: Failed to allocate memory\n");
+    return;
+  }
+
+  printf("Topology: %d CPUs on %d NUMA nodes, processes and threads %s.\n", num_cpus, num_nodes,
+         affinity_enabled ? "pinned" : "not pinned");
+  for (int node = 0; node < num_nodes; node++) {
+    int count = 0;
+    for (int i = 0; i < num_cpus; i++) {
+      if (cpus[i].node == node) ids[count++] = cpus[i].id;
+    }
+    if (count == 0) continue;
+
+    printf("  node %d: CPUs ", node);
+    print_cpus(ids, count);
+    printf("\n");
+  }
+
+  for (int group = 0; group < num_groups && num_cpus > 0; group++) {
+    int first, last;
+    group_range(group, &first, &last);
+    for (int i = first; i < last; i++) ids[i - first] = cpus[i].id;
+
+    printf("  process %d: CPUs ", group + 1);
+    print_cpus(ids, last - first);
+    if (cpus[first].node == cpus[last - 1].node) {
+      printf(" (node %d)\n", cpus[first].node);
+    } else {
+      printf(" (nodes %d-%d)\n", cpus[first].node, cpus[last - 1].node);
+    }
+  }
+  fflush(stdout);
+  free(ids);
+}
+
+int affinity_pin_group(int group) {
+  if (!affinity_enabled || num_cpus == 0) return 0;
+
+  int first, last;
+  group_range(group, &first, &last);
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int i = first; i < last; i++) CPU_SET((size_t)cpus[i].id, &set);
+
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    perror("Error setting the CPU affinity");
+    return 1;
+  }
+  return 0;
+}
+
+int affinity_pin_thread(int index) {
+  if (!affinity_enabled) return 0;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    perror("Error reading the CPU affinity");
+    return 1;
+  }
+
+  // Take the CPUs of the group in turn
+  int target = index % CPU_COUNT(&set);
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET((size_t)cpu, &set) || target-- > 0) continue;
+
+    CPU_ZERO(&set);
+    CPU_SET((size_t)cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+      perror("Error setting the CPU affinity");
+      return 1;
+    }
+    return 0;
+  }
+  return 0;
+}
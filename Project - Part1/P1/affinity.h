@@ -0,0 +1,28 @@
+#ifndef EMS_AFFINITY_H
+#define EMS_AFFINITY_H
+
+/// Whether processes and threads are pinned to CPUs, set from the command line before any file is processed.
+extern int affinity_enabled;
+
+/// Reads the CPUs the program may run on and the NUMA node of each, and splits them into groups.
+/// @note CPUs are ordered by node before being split, so each group stays on as few nodes as possible.
+/// @param num_groups Number of groups, one per process (or file worker) running at the same time.
+/// @return 0 if the topology was read successfully, 1 otherwise.
+int affinity_init(int num_groups);
+
+/// Writes the CPUs of each NUMA node and of each group to stdout.
+void affinity_report(void);
+
+/// Pins the calling thread, and every thread it creates afterwards, to the CPUs of a group.
+/// @note Called right after fork, this pins the whole child process. Memory is placed on the node of the
+///       thread that first touches it, so the events of the process end up on the nodes of its group.
+/// @param group Group of the caller, wrapped around the number of groups.
+/// @return 0 if the caller was pinned or pinning is off, 1 otherwise.
+int affinity_pin_group(int group);
+
+/// Pins the calling thread to one of the CPUs it may currently run on, spreading the threads of a pool.
+/// @param index Index of the thread in its pool, wrapped around the number of CPUs.
+/// @return 0 if the caller was pinned or pinning is off, 1 otherwise.
+int affinity_pin_thread(int index);
+
+#endif  // EMS_AFFINITY_H
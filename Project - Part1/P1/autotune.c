@@ -0,0 +1,124 @@
+#include "autotune.h"
+#include "auxFunctions.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/// Work done with one thread budget.
+struct LevelRecord {
+  uint64_t bytes;
+  uint64_t ns;
+};
+
+// File workers of -t record from several threads
+static pthread_mutex_t tuner_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int adaptive = 0;      // Whether the thread count was given as "auto"
+static int fixed_threads = 1; // Thread count given on the command line
+static int level = 0;         // Current budget is 1 << level threads
+static size_t bytes_per_thread = AUTO_BYTES_PER_THREAD;
+static struct LevelRecord records[AUTO_MAX_LEVEL + 1];
+
+uint64_t autotune_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int level_of(int num_threads) {
+  int result = 0;
+  while (result < AUTO_MAX_LEVEL && (1 << (result + 1)) <= num_threads) result++;
+  return result;
+}
+
+int autotune_init(const char *directoryPath, unsigned int delay_ms, int *num_proc, int *num_threads) {
+  adaptive = *num_threads == 0;
+  fixed_threads = *num_threads;
+  bytes_per_thread = delay_ms > 0 ? AUTO_BYTES_PER_DELAYED_THREAD : AUTO_BYTES_PER_THREAD;
+  if (*num_proc != 0 && !adaptive) return 0;
+
+  DIR *dir = opendir(directoryPath);
+  if (dir == NULL) {
+    perror("Error opening directory");
+    return 1;
+  }
+
+  // Only the file count and the largest file matter for the first guess
+  size_t num_files = 0, largest = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (!isJobFile(directoryPath, entry)) continue;
+
+    char *pathJobs = pathingJobs((char*)directoryPath, entry);
+    struct stat st;
+    if (pathJobs != NULL && stat(pathJobs, &st) == 0 && (size_t)st.st_size > largest) {
+      largest = (size_t)st.st_size;
+    }
+    free(pathJobs);
+    num_files++;
+  }
+  closedir(dir);
+
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  int cores = online > 0 ? (int)online : 1;
+
+  if (*num_proc == 0) {
+    *num_proc = num_files == 0 ? 1 : num_files < (size_t)cores ? (int)num_files : cores;
+  }
+  if (adaptive) {
+    // Cores left for each process, but no more threads than the largest file keeps busy
+    int budget = cores / *num_proc > 0 ? cores / *num_proc : 1;
+    size_t useful = largest / bytes_per_thread + 1;
+    if ((size_t)budget > useful) budget = (int)useful;
+
+    level = level_of(budget);
+    *num_threads = 1 << level;
+  }
+
+  printf("Auto: %d processes, %d threads per file on %d cores.\n", *num_proc, *num_threads, cores);
+  fflush(stdout);
+  return 0;
+}
+
+int autotune_threads(size_t size) {
+  if (!adaptive) return fixed_threads;
+
+  pthread_mutex_lock(&tuner_mutex);
+  int budget = 1 << level;
+  pthread_mutex_unlock(&tuner_mutex);
+
+  size_t useful = size / bytes_per_thread + 1;
+  return (size_t)budget < useful ? budget : (int)useful;
+}
+
+/// Throughput of a budget in bytes per microsecond, 0 when it was never tried.
+static double throughput(int at) {
+  return records[at].ns != 0 ? (double)records[at].bytes * 1000.0 / (double)records[at].ns : 0.0;
+}
+
+void autotune_record(int num_threads, size_t size, uint64_t ns) {
+  if (!adaptive) return;
+
+  pthread_mutex_lock(&tuner_mutex);
+  int at = level_of(num_threads);
+  records[at].bytes += size;
+  records[at].ns += ns > 0 ? ns : 1;
+
+  // Climb from the best budget so far: try the next one up, then the next one down, then stay
+  int best = at;
+  for (int l = 0; l <= AUTO_MAX_LEVEL; l++) {
+    if (throughput(l) > throughput(best)) best = l;
+  }
+  if (best < AUTO_MAX_LEVEL && records[best + 1].ns == 0) {
+    level = best + 1;
+  } else if (best > 0 && records[best - 1].ns == 0) {
+    level = best - 1;
+  } else {
+    level = best;
+  }
+  pthread_mutex_unlock(&tuner_mutex);
+}
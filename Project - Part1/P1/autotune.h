@@ -0,0 +1,37 @@
+#ifndef EMS_AUTOTUNE_H
+#define EMS_AUTOTUNE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AUTO_BYTES_PER_THREAD ((size_t)1 << 16)  // Job file bytes that keep one more thread busy
+#define AUTO_BYTES_PER_DELAYED_THREAD 512        // The same when every state access sleeps
+#define AUTO_MAX_LEVEL 6                         // Threads per file are powers of two, up to 1 << AUTO_MAX_LEVEL
+
+/// Picks the values of the process and thread counts given as "auto".
+/// @note Processes follow the number of job files and cores, and the cores left for each process become
+///       its thread budget. The budget then moves between powers of two as files finish, towards the one
+///       with the best measured throughput.
+/// @param directoryPath Directory with the job files.
+/// @param delay_ms State access delay; threads that sleep on it leave the core to others.
+/// @param num_proc Number of processes, 0 to pick it; set to the value picked.
+/// @param num_threads Number of threads per file, 0 to pick it; set to the initial budget.
+/// @return 0 if the values were picked successfully, 1 otherwise.
+int autotune_init(const char *directoryPath, unsigned int delay_ms, int *num_proc, int *num_threads);
+
+/// Gets the number of threads to run a job file with.
+/// @note With a fixed thread count this is always that count. Otherwise small files get fewer threads
+///       than the budget, one per AUTO_BYTES_PER_THREAD (or AUTO_BYTES_PER_DELAYED_THREAD) bytes.
+/// @param size Size of the job file in bytes.
+int autotune_threads(size_t size);
+
+/// Records how long a job file took, moving the thread budget for the next files.
+/// @param num_threads Threads the file was run with.
+/// @param size Size of the job file in bytes.
+/// @param ns Time it took, in nanoseconds.
+void autotune_record(int num_threads, size_t size, uint64_t ns);
+
+/// Current CLOCK_MONOTONIC time in nanoseconds.
+uint64_t autotune_clock(void);
+
+#endif  // EMS_AUTOTUNE_H
@@ -8,6 +8,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/stat.h>
 
 /* Function that creates the path to the input file */
 char *pathingJobs(char *directoryPath, struct dirent *entry) {
@@ -25,12 +28,43 @@ char *pathingJobs(char *directoryPath, struct dirent *entry) {
   return pathJobs;
 }
 
+/* Function that checks whether an entry is a job file to run, a .jobc replaces an older .jobs */
+int isJobFile(const char *directoryPath, struct dirent *entry) {
+  size_t len = strlen(entry->d_name);
+  int source = len >= 5 && strcmp(entry->d_name + len - 5, ".jobs") == 0;
+  int compiled = len >= 5 && strcmp(entry->d_name + len - 5, ".jobc") == 0;
+  if (!source && !compiled) {
+    return 0;
+  }
+
+  // Both versions of the file would write the same output, only the up to date one runs
+  char path[PATH_MAX], sibling[PATH_MAX];
+  int written = snprintf(path, sizeof(path), "%s/%s", directoryPath, entry->d_name);
+  if (written < 0 || (size_t)written >= sizeof(path)) {
+    return 1;
+  }
+  memcpy(sibling, path, (size_t)written + 1);
+  sibling[written - 1] = source ? 'c' : 's';
+
+  struct stat jobStat, siblingStat;
+  if (stat(sibling, &siblingStat) != 0 || stat(path, &jobStat) != 0) {
+    return 1;
+  }
+
+  struct stat *sourceStat = source ? &jobStat : &siblingStat;
+  struct stat *compiledStat = source ? &siblingStat : &jobStat;
+  int compiledIsCurrent = compiledStat->st_mtim.tv_sec > sourceStat->st_mtim.tv_sec ||
+                          (compiledStat->st_mtim.tv_sec == sourceStat->st_mtim.tv_sec &&
+                           compiledStat->st_mtim.tv_nsec >= sourceStat->st_mtim.tv_nsec);
+  return compiled == compiledIsCurrent;
+}
+
 /* Function that creates the path to the output file */
 char* pathingOut(const char *directoryPath, struct dirent *entry) {
-  const char *extension_to_remove = ".jobs";
+  const char *extension_to_remove = ".job";
   const char *new_extension = ".out";
 
-  // Find the position of the ".jobs" extension in the string
+  // Find the position of the ".jobs" or ".jobc" extension in the string
   const char *extension_position = strstr(entry->d_name, extension_to_remove);
 
   // Calculate the length of the part of the filename before the ".jobs" extension
@@ -48,15 +82,19 @@ char* pathingOut(const char *directoryPath, struct dirent *entry) {
   // Copy the directory path and the filename prefix to the new string
   strcpy(pathFileOut, directoryPath);
   strcat(pathFileOut, "/");
-  strncat(pathFileOut, entry->d_name, prefix_length);
-  strcat(pathFileOut, new_extension);
+  memcpy(pathFileOut + directory_length + 1, entry->d_name, prefix_length);
+  strcpy(pathFileOut + directory_length + 1 + prefix_length, new_extension);
 
   return pathFileOut;
 }
 
 /* Functtion that writes to the output file */
 int writeFile(int fd, char* buffer) {
-    size_t len = strlen(buffer);
+    return writeBuffer(fd, buffer, strlen(buffer));
+}
+
+/* Function that writes len bytes to the output file */
+int writeBuffer(int fd, const char* buffer, size_t len) {
     size_t done = 0;
 
     while (len > 0) {
@@ -75,40 +113,126 @@ int writeFile(int fd, char* buffer) {
     return 0;
 }
 
-void freeMutexes(struct Event* event, size_t num_rows, size_t num_cols) {
-    int num_seats = (int)(num_rows * num_cols);
+/// Two ASCII digits for every number from 00 to 99.
+static const char digitPairs[201] =
+    "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+    "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
 
-    for (int i = 0; i < num_seats; i++) {
-        if (pthread_mutex_destroy(&event->seatsLock[i]) != 0) {
-            fprintf(stderr, "Error destroying mutex %d\n", i);
-        }
-    }
-    free(event->seatsLock);
+char* writeUint(char* dest, unsigned int value) {
+  if (value < 10) {
+    *dest = (char)('0' + value);
+    return dest + 1;
+  }
+
+  size_t len = value < 100 ? 2 : value < 1000 ? 3 : value < 10000 ? 4 : value < 100000 ? 5
+             : value < 1000000 ? 6 : value < 10000000 ? 7 : value < 100000000 ? 8 : value < 1000000000 ? 9 : 10;
+
+  // Fill from the end, two digits per division
+  char* p = dest + len;
+  while (value >= 100) {
+    unsigned int pair = (value % 100) * 2;
+    value /= 100;
+    *--p = digitPairs[pair + 1];
+    *--p = digitPairs[pair];
+  }
+  if (value >= 10) {
+    *--p = digitPairs[value * 2 + 1];
+    *--p = digitPairs[value * 2];
+  } else {
+    *--p = (char)('0' + value);
+  }
+
+  return dest + len;
 }
 
-void switchPositions(size_t* firstVector, size_t* secondVector, size_t i, size_t j) {
-  size_t temp = firstVector[i];
-  firstVector[i] = firstVector[j];
-  firstVector[j] = temp;
+/// Reservations with fewer seats are sorted by insertion, which beats the radix passes.
+#define RADIX_SORT_MIN 32
+
+/// Sort buffers of the calling thread, reused by every reservation it makes.
+static _Thread_local uint64_t *sortKeys = NULL;
+static _Thread_local size_t sortCapacity = 0;
 
-  temp = secondVector[i];
-  secondVector[i] = secondVector[j];
-  secondVector[j] = temp;
+void freeSortScratch(void) {
+  free(sortKeys);
+  sortKeys = NULL;
+  sortCapacity = 0;
 }
 
-int sortVectors(size_t num_seats, size_t* firstVector, size_t* secondVector) {
-  for (size_t i = 0; i < num_seats - 1; i++) {
-    for (size_t j = 0; j < num_seats - i - 1; j++) {
-      if (firstVector[j] > firstVector[j + 1]) {
-          switchPositions(firstVector, secondVector, j, j + 1);
-      }
-      else if (firstVector[j] == firstVector[j + 1] && secondVector[j] == secondVector[j + 1]) {
-        return 1;
-      }
-      else if (firstVector[j] == firstVector[j + 1] && secondVector[j] > secondVector[j + 1]) {
-          switchPositions(firstVector, secondVector, j, j + 1);
+static void radixSort(uint64_t *keys, uint64_t *tmp, size_t n) {
+  uint64_t *result = keys;
+  size_t counts[8][256];
+  memset(counts, 0, sizeof(counts));
+
+  for (size_t i = 0; i < n; i++) {
+    for (int b = 0; b < 8; b++) {
+      counts[b][(keys[i] >> (8 * b)) & 0xff]++;
+    }
+  }
+
+  for (int b = 0; b < 8; b++) {
+    // Skip the bytes every key has in common, usually the high bytes of row and column
+    if (counts[b][(keys[0] >> (8 * b)) & 0xff] == n) continue;
+
+    size_t offset = 0;
+    for (int d = 0; d < 256; d++) {
+      size_t count = counts[b][d];
+      counts[b][d] = offset;
+      offset += count;
+    }
+    for (size_t i = 0; i < n; i++) {
+      tmp[counts[b][(keys[i] >> (8 * b)) & 0xff]++] = keys[i];
+    }
+
+    uint64_t *swap = keys;
+    keys = tmp;
+    tmp = swap;
+  }
+
+  // An odd number of passes leaves the result in the other buffer
+  if (keys != result) {
+    memcpy(result, keys, n * sizeof(uint64_t));
+  }
+}
+
+int sortVectors(size_t num_seats, size_t* xs, size_t* ys) {
+  if (num_seats < 2) return 0;
+
+  if (2 * num_seats > sortCapacity) {
+    uint64_t *keys = realloc(sortKeys, 2 * num_seats * sizeof(uint64_t));
+    if (keys == NULL) {
+      fprintf(stderr, "Error allocating memory for sorting.\n");
+      return 1;
+    }
+    sortKeys = keys;
+    sortCapacity = 2 * num_seats;
+  }
+
+  // Rows and columns are parsed as unsigned int, so (row, col) packs into one ordered key
+  uint64_t *keys = sortKeys;
+  for (size_t i = 0; i < num_seats; i++) {
+    keys[i] = ((uint64_t)xs[i] << 32) | (uint64_t)ys[i];
+  }
+
+  if (num_seats < RADIX_SORT_MIN) {
+    for (size_t i = 1; i < num_seats; i++) {
+      uint64_t key = keys[i];
+      size_t j = i;
+      for (; j > 0 && keys[j - 1] > key; j--) {
+        keys[j] = keys[j - 1];
       }
+      keys[j] = key;
+    }
+  } else {
+    radixSort(keys, keys + num_seats, num_seats);
+  }
+
+  // Duplicated seats end up next to each other
+  for (size_t i = 0; i < num_seats; i++) {
+    if (i > 0 && keys[i] == keys[i - 1]) {
+      return 1;
     }
+    xs[i] = (size_t)(keys[i] >> 32);
+    ys[i] = (size_t)(keys[i] & 0xffffffff);
   }
   return 0;
 }
@@ -6,10 +6,12 @@
 #include "eventlist.h"
 
 int writeFile(int fd, char* buffer);
+int writeBuffer(int fd, const char* buffer, size_t len);
+char* writeUint(char* dest, unsigned int value);
 char* pathingOut(const char *directoryPath, struct dirent *entry);
 char *pathingJobs(char *directoryPath, struct dirent *entry);
-void freeMutexes(struct Event* event, size_t num_rows, size_t num_cols);
+int isJobFile(const char *directoryPath, struct dirent *entry);
 int sortVectors(size_t num_seats, size_t* xs, size_t* ys);
-void switchPositions(size_t* xs, size_t* ys, size_t i, size_t j);
+void freeSortScratch(void);
 
 #endif
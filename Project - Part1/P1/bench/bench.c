@@ -0,0 +1,180 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_VALUES 64  // Values accepted in each sweep list
+
+/* Function that splits a comma separated list of values */
+static int parse_list(char *text, char **values, int *count) {
+  *count = 0;
+  for (char *token = strtok(text, ","); token != NULL; token = strtok(NULL, ",")) {
+    if (*count == MAX_VALUES) {
+      fprintf(stderr, "Too many values in list\n");
+      return 1;
+    }
+    values[(*count)++] = token;
+  }
+
+  if (*count == 0) {
+    fprintf(stderr, "Empty list\n");
+    return 1;
+  }
+  return 0;
+}
+
+/* Function that counts the commands of the job files of a directory */
+static long count_commands(const char *directoryPath) {
+  DIR *dir = opendir(directoryPath);
+  if (dir == NULL) {
+    perror("Error opening directory");
+    return -1;
+  }
+
+  long commands = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    size_t len = strlen(entry->d_name);
+    if (len < 5 || strcmp(entry->d_name + len - 5, ".jobs") != 0) continue;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", directoryPath, entry->d_name);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) continue;
+
+    // Every non-empty line is one command
+    int previous = '\n', ch;
+    while ((ch = fgetc(file)) != EOF) {
+      if (previous == '\n' && ch != '\n') commands++;
+      previous = ch;
+    }
+    fclose(file);
+  }
+
+  closedir(dir);
+  return commands;
+}
+
+/* Function that runs ems once and returns its wall time in seconds, or a negative value on failure */
+static double run_ems(char **args) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("Error forking process");
+    return -1;
+  }
+  if (pid == 0) {
+    // Only the timing matters, the progress messages of ems are dropped
+    int null = open("/dev/null", O_WRONLY);
+    if (null != -1) {
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+      close(null);
+    }
+    execv(args[0], args);
+    _exit(127);
+  }
+
+  int status;
+  while (waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      perror("Error waiting for ems");
+      return -1;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    return -1;
+  }
+  return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void usage(const char *program) {
+  fprintf(stderr, "Usage: %s [-o ems_option] <ems> <directory> <procs,...> <threads,...> <delays_ms,...> [runs]\n",
+          program);
+}
+
+/* Main function that sweeps ems over processes x threads x delays and prints one CSV row per run */
+int main(int argc, char *argv[]) {
+  char *ems_option = NULL;
+
+  int option;
+  while ((option = getopt(argc, argv, "o:")) != -1) {
+    switch (option) {
+      case 'o':
+        ems_option = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  if (argc != 6 && argc != 7) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  char *procs[MAX_VALUES], *threads[MAX_VALUES], *delays[MAX_VALUES];
+  int num_procs, num_threads, num_delays;
+  if (parse_list(argv[3], procs, &num_procs) != 0 || parse_list(argv[4], threads, &num_threads) != 0 ||
+      parse_list(argv[5], delays, &num_delays) != 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  long runs = argc == 7 ? strtol(argv[6], NULL, 10) : 1;
+  if (runs < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  long commands = count_commands(argv[2]);
+  if (commands < 0) {
+    return 1;
+  }
+
+  printf("mode,procs,threads,delay_ms,run,commands,wall_s,commands_per_s,status\n");
+  int failed = 0;
+  for (int p = 0; p < num_procs; p++) {
+    for (int t = 0; t < num_threads; t++) {
+      for (int d = 0; d < num_delays; d++) {
+        for (long r = 1; r <= runs; r++) {
+          char *args[7];
+          int n = 0;
+          args[n++] = argv[1];
+          if (ems_option != NULL) args[n++] = ems_option;
+          args[n++] = argv[2];
+          args[n++] = procs[p];
+          args[n++] = threads[t];
+          args[n++] = delays[d];
+          args[n] = NULL;
+
+          double wall = run_ems(args);
+          const char *mode = ems_option != NULL ? ems_option : "fork";
+          if (wall < 0) {
+            printf("%s,%s,%s,%s,%ld,%ld,,,failed\n", mode, procs[p], threads[t], delays[d], r, commands);
+            failed = 1;
+          } else {
+            printf("%s,%s,%s,%s,%ld,%ld,%.6f,%.1f,ok\n", mode, procs[p], threads[t], delays[d], r, commands, wall,
+                   wall > 0 ? (double)commands / wall : 0.0);
+          }
+          fflush(stdout);
+        }
+      }
+    }
+  }
+
+  return failed;
+}
@@ -0,0 +1,187 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/// Shape of the generated workload.
+struct GeneratorOptions {
+  unsigned long files;       /// Number of .jobs files.
+  unsigned long commands;    /// Commands per file, after the CREATEs.
+  unsigned long events;      /// Events created at the start of each file.
+  unsigned long max_rows;    /// Largest number of rows of an event.
+  unsigned long max_cols;    /// Largest number of columns of an event.
+  unsigned long max_seats;   /// Largest number of seats of a RESERVE.
+  unsigned long conflict;    /// Percentage of RESERVEs that also claim the first seat of their event.
+  unsigned long show;        /// Percentage of commands that are SHOWs.
+  unsigned long list;        /// Per mille of commands that are LISTs.
+  unsigned long barrier;     /// Per mille of commands that are BARRIERs.
+  unsigned long wait;        /// Per mille of commands that are WAITs.
+  unsigned long wait_ms;     /// Delay of every WAIT.
+  unsigned long threads;     /// Highest thread targeted by a WAIT, 0 for untargeted WAITs only.
+  unsigned long seed;
+};
+
+/* Function that returns the next value of a xorshift generator */
+static uint64_t next_random(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *state = x;
+  return x;
+}
+
+/* Function that returns a random value in [low, high] */
+static unsigned long random_between(uint64_t *state, unsigned long low, unsigned long high) {
+  return low + (unsigned long)(next_random(state) % (high - low + 1));
+}
+
+/* Function that writes one RESERVE, with distinct seats so that only conflicts make it fail */
+static void write_reserve(FILE *file, uint64_t *state, struct GeneratorOptions *options, unsigned long event,
+                          unsigned long rows, unsigned long cols) {
+  unsigned long capacity = rows * cols;
+  unsigned long seats = random_between(state, 1, options->max_seats < capacity ? options->max_seats : capacity);
+  int conflict = random_between(state, 1, 100) <= options->conflict;
+
+  // Consecutive seats from a random start, the first seat is left to the conflicting RESERVEs
+  unsigned long start = capacity > seats ? random_between(state, 1, capacity - seats) : 0;
+  if (conflict) start = 0;
+
+  fprintf(file, "RESERVE %lu [", event);
+  for (unsigned long k = 0; k < seats; k++) {
+    unsigned long index = (start + k) % capacity;
+    fprintf(file, "%s(%lu,%lu)", k > 0 ? " " : "", index / cols + 1, index % cols + 1);
+  }
+  fprintf(file, "]\n");
+}
+
+/* Function that generates one job file */
+static int generate_file(const char *path, uint64_t *state, struct GeneratorOptions *options) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  unsigned long *rows = malloc(options->events * sizeof(unsigned long));
+  unsigned long *cols = malloc(options->events * sizeof(unsigned long));
+  if (rows == NULL || cols == NULL) {
+    fprintf(stderr, "Error: Failed to allocate memory\n");
+    free(rows);
+    free(cols);
+    fclose(file);
+    return 1;
+  }
+
+  for (unsigned long e = 0; e < options->events; e++) {
+    rows[e] = random_between(state, 1, options->max_rows);
+    cols[e] = random_between(state, 1, options->max_cols);
+    fprintf(file, "CREATE %lu %lu %lu\n", e + 1, rows[e], cols[e]);
+  }
+
+  for (unsigned long c = 0; c < options->commands; c++) {
+    unsigned long event = random_between(state, 0, options->events - 1);
+    unsigned long roll = random_between(state, 0, 999);
+
+    if (roll < options->barrier) {
+      fprintf(file, "BARRIER\n");
+    } else if ((roll -= options->barrier) < options->wait) {
+      if (options->threads > 0 && random_between(state, 0, 1)) {
+        fprintf(file, "WAIT %lu %lu\n", options->wait_ms, random_between(state, 1, options->threads));
+      } else {
+        fprintf(file, "WAIT %lu\n", options->wait_ms);
+      }
+    } else if ((roll -= options->wait) < options->list) {
+      fprintf(file, "LIST\n");
+    } else if (random_between(state, 1, 100) <= options->show) {
+      fprintf(file, "SHOW %lu\n", event + 1);
+    } else {
+      write_reserve(file, state, options, event + 1, rows[event], cols[event]);
+    }
+  }
+
+  free(rows);
+  free(cols);
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Error writing %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+/* Function that parses a numeric option */
+static int parse_option(const char *text, unsigned long min, unsigned long max, unsigned long *value) {
+  char *endptr;
+  errno = 0;
+  unsigned long parsed = strtoul(text, &endptr, 10);
+  if (errno != 0 || *text == '\0' || *endptr != '\0' || parsed < min || parsed > max) {
+    return 1;
+  }
+
+  *value = parsed;
+  return 0;
+}
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [-f files] [-n commands] [-e events] [-r max_rows] [-c max_cols] [-s max_seats]\n"
+          "          [-x conflict_%%] [-v show_%%] [-l list_permille] [-b barrier_permille]\n"
+          "          [-w wait_permille] [-d wait_ms] [-t wait_threads] [-S seed] <directory>\n",
+          program);
+}
+
+/* Main function that writes <files> synthetic job files to a directory */
+int main(int argc, char *argv[]) {
+  struct GeneratorOptions options = {
+      .files = 4, .commands = 10000, .events = 16, .max_rows = 50, .max_cols = 50, .max_seats = 8,
+      .conflict = 5, .show = 10, .list = 1, .barrier = 2, .wait = 1, .wait_ms = 1, .threads = 0, .seed = 1,
+  };
+
+  int option;
+  while ((option = getopt(argc, argv, "f:n:e:r:c:s:x:v:l:b:w:d:t:S:")) != -1) {
+    int invalid;
+    switch (option) {
+      case 'f': invalid = parse_option(optarg, 1, 100000, &options.files); break;
+      case 'n': invalid = parse_option(optarg, 0, ULONG_MAX / 2, &options.commands); break;
+      case 'e': invalid = parse_option(optarg, 1, UINT_MAX, &options.events); break;
+      case 'r': invalid = parse_option(optarg, 1, 65536, &options.max_rows); break;
+      case 'c': invalid = parse_option(optarg, 1, 65536, &options.max_cols); break;
+      case 's': invalid = parse_option(optarg, 1, 1000000, &options.max_seats); break;
+      case 'x': invalid = parse_option(optarg, 0, 100, &options.conflict); break;
+      case 'v': invalid = parse_option(optarg, 0, 100, &options.show); break;
+      case 'l': invalid = parse_option(optarg, 0, 1000, &options.list); break;
+      case 'b': invalid = parse_option(optarg, 0, 1000, &options.barrier); break;
+      case 'w': invalid = parse_option(optarg, 0, 1000, &options.wait); break;
+      case 'd': invalid = parse_option(optarg, 0, UINT_MAX, &options.wait_ms); break;
+      case 't': invalid = parse_option(optarg, 0, INT_MAX, &options.threads); break;
+      case 'S': invalid = parse_option(optarg, 1, ULONG_MAX, &options.seed); break;
+      default: invalid = 1; break;
+    }
+    if (invalid) {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind != argc - 1 || options.barrier + options.wait + options.list > 1000) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  uint64_t state = options.seed * 0x9E3779B97F4A7C15ull;
+  for (unsigned long f = 0; f < options.files; f++) {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/bench-%lu.jobs", argv[optind], f + 1) >= (int)sizeof(path)) {
+      fprintf(stderr, "Directory path too long\n");
+      return 1;
+    }
+    if (generate_file(path, &state, &options) != 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
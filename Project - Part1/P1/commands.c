@@ -0,0 +1,386 @@
+#include "commands.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PARSE_CHUNK_MIN 65536  // Smallest piece of a job file worth its own parsing thread
+
+/// Commands parsed from one line-aligned piece of a job file.
+struct ParseChunk {
+  struct JobFile file;  // Cursor over the whole file, starting at the chunk
+  size_t start;         // Offset where the chunk was planned to start
+  size_t end;           // Commands starting before this offset belong to the chunk
+
+  struct JobCommand *commands;
+  size_t num_commands;
+  size_t cap_commands;
+
+  struct SeatBuffer seats;  // Seats of the chunk's RESERVEs
+
+  int failed;
+};
+
+static int push_command(struct ParseChunk *chunk, struct JobCommand *command) {
+  if (chunk->num_commands == chunk->cap_commands) {
+    size_t new_cap = chunk->cap_commands ? chunk->cap_commands * 2 : 256;
+    struct JobCommand *commands = realloc(chunk->commands, new_cap * sizeof(struct JobCommand));
+    if (commands == NULL) return 1;
+    chunk->commands = commands;
+    chunk->cap_commands = new_cap;
+  }
+
+  chunk->commands[chunk->num_commands++] = *command;
+  return 0;
+}
+
+static void parse_chunk(struct ParseChunk *chunk) {
+  struct JobFile *file = &chunk->file;
+
+  while (file->pos < chunk->end) {
+    struct JobCommand command;
+    memset(&command, 0, sizeof(command));
+    command.type = get_next(file);
+
+    switch (command.type) {
+      case CMD_CREATE:
+        if (parse_create(file, &command.event_id, &command.num_rows, &command.num_cols) != 0) {
+          command.type = CMD_INVALID;
+        }
+        break;
+
+      case CMD_RESERVE:
+        command.coords = chunk->seats.count;
+        command.num_coords = parse_reserve(file, &command.event_id, &chunk->seats);
+        if (chunk->seats.failed) {
+          chunk->failed = 1;
+          return;
+        }
+        if (command.num_coords == 0) {
+          command.type = CMD_INVALID;
+          command.coords = 0;
+        }
+        break;
+
+      case CMD_SHOW:
+        if (parse_show(file, &command.event_id) != 0) {
+          command.type = CMD_INVALID;
+        }
+        break;
+
+      case CMD_WAIT:
+        if (parse_wait(file, &command.delay, &command.thread_id) == -1) {
+          command.type = CMD_INVALID;
+        }
+        break;
+
+      case CMD_LIST_EVENTS:
+      case CMD_BARRIER:
+      case CMD_HELP:
+      case CMD_INVALID:
+        break;
+
+      case CMD_EMPTY:
+        continue;
+
+      case EOC:
+        return;
+    }
+
+    if (push_command(chunk, &command) != 0) {
+      chunk->failed = 1;
+      return;
+    }
+  }
+}
+
+static void* parse_chunk_thread(void *args) {
+  parse_chunk((struct ParseChunk*)args);
+  return NULL;
+}
+
+/// Finds the offset just after the first newline at or after pos.
+static size_t line_end(struct JobFile *file, size_t pos) {
+  if (pos >= file->size) return file->size;
+
+  const char *newline = memchr(file->data + pos, '\n', file->size - pos);
+  return newline != NULL ? (size_t)(newline - file->data) + 1 : file->size;
+}
+
+static void reset_chunk(struct ParseChunk *chunk, size_t pos) {
+  chunk->num_commands = 0;
+  chunk->seats.count = 0;
+  chunk->file.pos = pos;
+}
+
+/// Concatenates the chunks into the stream and splits it into segments.
+static int merge_chunks(struct ParseChunk *chunks, size_t num_chunks, struct CommandStream *stream) {
+  size_t total_commands = 0, total_coords = 0;
+  for (size_t k = 0; k < num_chunks; k++) {
+    total_commands += chunks[k].num_commands;
+    total_coords += chunks[k].seats.count;
+  }
+
+  stream->commands = malloc((total_commands + 1) * sizeof(struct JobCommand));
+  stream->xs = malloc((total_coords + 1) * sizeof(size_t));
+  stream->ys = malloc((total_coords + 1) * sizeof(size_t));
+  if (stream->commands == NULL || stream->xs == NULL || stream->ys == NULL) return 1;
+
+  for (size_t k = 0; k < num_chunks; k++) {
+    struct ParseChunk *chunk = &chunks[k];
+    for (size_t i = 0; i < chunk->num_commands; i++) {
+      struct JobCommand *command = &stream->commands[stream->num_commands++];
+      *command = chunk->commands[i];
+      if (command->type == CMD_RESERVE) {
+        command->coords += stream->num_coords;
+      }
+    }
+    if (chunk->seats.count > 0) {
+      memcpy(stream->xs + stream->num_coords, chunk->seats.xs, chunk->seats.count * sizeof(size_t));
+      memcpy(stream->ys + stream->num_coords, chunk->seats.ys, chunk->seats.count * sizeof(size_t));
+      stream->num_coords += chunk->seats.count;
+    }
+  }
+
+  return index_command_stream(stream);
+}
+
+int index_command_stream(struct CommandStream *stream) {
+  // BARRIER and WAIT for all threads end a segment; they are never dispatched themselves
+  size_t num_boundaries = 0;
+  for (size_t i = 0; i < stream->num_commands; i++) {
+    struct JobCommand *command = &stream->commands[i];
+    if (command->type == CMD_BARRIER || (command->type == CMD_WAIT && command->thread_id == 0 && command->delay > 0)) {
+      num_boundaries++;
+    }
+  }
+
+  stream->segments = malloc((num_boundaries + 1) * sizeof(struct JobSegment));
+  if (stream->segments == NULL) return 1;
+
+  size_t start = 0;
+  for (size_t i = 0; i < stream->num_commands; i++) {
+    struct JobCommand *command = &stream->commands[i];
+    if (command->type == CMD_BARRIER || (command->type == CMD_WAIT && command->thread_id == 0 && command->delay > 0)) {
+      stream->segments[stream->num_segments++] = (struct JobSegment){start, i, command->delay};
+      start = i + 1;
+    }
+  }
+  stream->segments[stream->num_segments++] = (struct JobSegment){start, stream->num_commands, 0};
+
+  // Runs of RESERVEs on one event are claimed and applied together
+  for (size_t i = stream->num_commands; i-- > 0;) {
+    struct JobCommand *command = &stream->commands[i];
+    struct JobCommand *next = i + 1 < stream->num_commands ? command + 1 : NULL;
+    command->batch = 1;
+    if (command->type == CMD_RESERVE && next != NULL && next->type == CMD_RESERVE &&
+        next->event_id == command->event_id && next->batch < RESERVE_BATCH_MAX) {
+      command->batch = next->batch + 1;
+    }
+  }
+
+  return 0;
+}
+
+int compile_job_file(struct JobFile *file, int max_parsers, struct CommandStream *stream) {
+  memset(stream, 0, sizeof(struct CommandStream));
+
+  size_t num_chunks = file->size / PARSE_CHUNK_MIN + 1;
+  if (max_parsers < 1) max_parsers = 1;
+  if (num_chunks > (size_t)max_parsers) num_chunks = (size_t)max_parsers;
+
+  struct ParseChunk *chunks = calloc(num_chunks, sizeof(struct ParseChunk));
+  pthread_t *threads = calloc(num_chunks, sizeof(pthread_t));
+  int *started = calloc(num_chunks, sizeof(int));
+  if (chunks == NULL || threads == NULL || started == NULL) {
+    fprintf(stderr, "Error allocating memory for the parser.\n");
+    free(chunks);
+    free(threads);
+    free(started);
+    return 1;
+  }
+
+  // Split the file at line boundaries
+  size_t start = file->pos;
+  for (size_t k = 0; k < num_chunks; k++) {
+    size_t end = k + 1 == num_chunks ? file->size : line_end(file, file->size / num_chunks * (k + 1));
+    if (end < start) end = start;
+
+    chunks[k].file = (struct JobFile){file->data, file->size, start};
+    chunks[k].start = start;
+    chunks[k].end = end;
+    start = end;
+  }
+
+  for (size_t k = 1; k < num_chunks; k++) {
+    started[k] = pthread_create(&threads[k], NULL, parse_chunk_thread, &chunks[k]) == 0;
+  }
+  parse_chunk(&chunks[0]);
+  for (size_t k = 1; k < num_chunks; k++) {
+    if (started[k]) {
+      pthread_join(threads[k], NULL);
+    } else {
+      parse_chunk(&chunks[k]);
+    }
+  }
+
+  // A malformed line skips to the next newline and may have consumed the start of the next chunk
+  for (size_t k = 1; k < num_chunks; k++) {
+    if (chunks[k - 1].file.pos != chunks[k].start) {
+      reset_chunk(&chunks[k], chunks[k - 1].file.pos);
+      chunks[k].start = chunks[k - 1].file.pos;
+      parse_chunk(&chunks[k]);
+    }
+  }
+
+  int result = 0;
+  for (size_t k = 0; k < num_chunks; k++) {
+    if (chunks[k].failed) result = 1;
+  }
+
+  if (result == 0) {
+    result = merge_chunks(chunks, num_chunks, stream);
+  }
+  if (result != 0) {
+    fprintf(stderr, "Error allocating memory for the commands.\n");
+    free_command_stream(stream);
+  }
+
+  file->pos = chunks[num_chunks - 1].file.pos;
+  for (size_t k = 0; k < num_chunks; k++) {
+    free(chunks[k].commands);
+    free(chunks[k].seats.xs);
+    free(chunks[k].seats.ys);
+  }
+  free(chunks);
+  free(threads);
+  free(started);
+
+  return result;
+}
+
+void free_command_stream(struct CommandStream *stream) {
+  free(stream->commands);
+  free(stream->xs);
+  free(stream->ys);
+  free(stream->segments);
+  memset(stream, 0, sizeof(struct CommandStream));
+}
+
+/// Fibonacci hash of an event id reduced to [0, range), from the high bits of the product: its low bits
+/// barely depend on the high bits of the id, so strided ids such as multiples of 65536 would collide.
+static size_t hash_event(unsigned int event_id, size_t range) {
+  return (size_t)(((uint64_t)(uint32_t)(event_id * 2654435761u) * range) >> 32);
+}
+
+/// Picks the shard of a command.
+static size_t shard_of(struct JobCommand *command, size_t num_shards) {
+  switch (command->type) {
+    case CMD_CREATE:
+    case CMD_RESERVE:
+    case CMD_SHOW:
+      // Fibonacci hashing, like the event directory, so consecutive ids spread over the shards
+      return hash_event(command->event_id, num_shards);
+
+    case CMD_WAIT:
+      if (command->thread_id > 0 && command->thread_id <= num_shards) {
+        return command->thread_id - 1;
+      }
+      return 0;
+
+    case CMD_LIST_EVENTS:
+    case CMD_BARRIER:
+    case CMD_HELP:
+    case CMD_EMPTY:
+    case CMD_INVALID:
+    case EOC:
+      return 0;
+  }
+  return 0;
+}
+
+/// Whether a command ends a phase; a LIST also starts one.
+static int is_fence(struct JobCommand *command) {
+  return command->type == CMD_BARRIER || command->type == CMD_LIST_EVENTS ||
+         (command->type == CMD_WAIT && command->thread_id == 0 && command->delay > 0);
+}
+
+int plan_shards(struct CommandStream *stream, size_t num_shards, struct ShardPlan *plan) {
+  memset(plan, 0, sizeof(struct ShardPlan));
+  plan->num_shards = num_shards;
+
+  // A LIST may add a phase before it and is a phase of its own
+  size_t max_phases = 1;
+  for (size_t i = 0; i < stream->num_commands; i++) {
+    if (is_fence(&stream->commands[i])) max_phases += 2;
+  }
+
+  plan->queue_starts = malloc((max_phases * num_shards + 1) * sizeof(size_t));
+  plan->order = malloc((stream->num_commands + 1) * sizeof(size_t));
+  plan->phase_ends = malloc(max_phases * sizeof(size_t));
+  plan->phase_delays = malloc(max_phases * sizeof(unsigned int));
+  size_t *counts = malloc(num_shards * sizeof(size_t));
+  if (plan->queue_starts == NULL || plan->order == NULL || plan->phase_ends == NULL ||
+      plan->phase_delays == NULL || counts == NULL) {
+    fprintf(stderr, "Error allocating memory for the shard plan.\n");
+    free(counts);
+    free_shard_plan(plan);
+    return 1;
+  }
+
+  size_t used = 0;
+  size_t start = 0;
+  while (start <= stream->num_commands) {
+    // A phase runs up to the next fence, a LIST at its start is alone
+    size_t end = start;
+    if (end < stream->num_commands && stream->commands[end].type == CMD_LIST_EVENTS) {
+      end++;
+    } else {
+      while (end < stream->num_commands && !is_fence(&stream->commands[end])) end++;
+    }
+
+    // Counting pass, then every queue is filled in file order
+    memset(counts, 0, num_shards * sizeof(size_t));
+    for (size_t i = start; i < end; i++) {
+      counts[shard_of(&stream->commands[i], num_shards)]++;
+    }
+    size_t *starts = plan->queue_starts + plan->num_phases * num_shards;
+    for (size_t k = 0; k < num_shards; k++) {
+      starts[k] = used;
+      used += counts[k];
+      counts[k] = starts[k];
+    }
+    for (size_t i = start; i < end; i++) {
+      plan->order[counts[shard_of(&stream->commands[i], num_shards)]++] = i;
+    }
+
+    // BARRIERs and WAITs for all threads only separate phases
+    unsigned int delay = 0;
+    size_t next = end;
+    if (end < stream->num_commands && is_fence(&stream->commands[end]) &&
+        stream->commands[end].type != CMD_LIST_EVENTS) {
+      delay = stream->commands[end].type == CMD_WAIT ? stream->commands[end].delay : 0;
+      next = end + 1;
+    }
+    plan->phase_ends[plan->num_phases] = next;
+    plan->phase_delays[plan->num_phases] = delay;
+    plan->num_phases++;
+
+    if (end == stream->num_commands) break;
+    start = next;
+  }
+  plan->queue_starts[plan->num_phases * num_shards] = used;
+
+  free(counts);
+  return 0;
+}
+
+void free_shard_plan(struct ShardPlan *plan) {
+  free(plan->queue_starts);
+  free(plan->order);
+  free(plan->phase_ends);
+  free(plan->phase_delays);
+  memset(plan, 0, sizeof(struct ShardPlan));
+}
@@ -0,0 +1,84 @@
+#ifndef EMS_COMMANDS_H
+#define EMS_COMMANDS_H
+
+#include "parser.h"
+
+#include <stddef.h>
+
+#define RESERVE_BATCH_MAX 64  // Most RESERVEs applied under one event lookup
+
+/// A decoded job file command.
+struct JobCommand {
+  enum Command type;
+  unsigned int event_id;   /// CREATE, RESERVE and SHOW.
+  unsigned int delay;      /// WAIT delay in milliseconds.
+  unsigned int thread_id;  /// WAIT target thread, 0 for all threads.
+  size_t num_rows;         /// CREATE.
+  size_t num_cols;         /// CREATE.
+  size_t num_coords;       /// RESERVE: number of seats.
+  size_t coords;           /// RESERVE: index of the first seat in the stream's xs/ys.
+  size_t batch;            /// RESERVE: consecutive RESERVEs on the same event from this one, 1 otherwise.
+};
+
+/// Range of commands that may run concurrently, ended by a BARRIER or a WAIT for all threads.
+struct JobSegment {
+  size_t start;        /// Index of the first command of the segment.
+  size_t end;          /// Index of the command that ends the segment (exclusive).
+  unsigned int delay;  /// Delay all threads observe before the next segment starts.
+};
+
+/// A job file compiled to decoded commands.
+struct CommandStream {
+  struct JobCommand *commands;
+  size_t num_commands;
+
+  size_t *xs;  /// Rows of the seats of every RESERVE, in file order.
+  size_t *ys;  /// Columns of the seats of every RESERVE, in file order.
+  size_t num_coords;
+
+  struct JobSegment *segments;
+  size_t num_segments;
+};
+
+/// Assignment of the commands of a stream to threads by event.
+/// @note The stream is cut into phases at BARRIERs, WAITs for all threads and LISTs; a LIST is a
+///       phase of its own. Within a phase every thread runs its queue in file order.
+struct ShardPlan {
+  size_t num_shards;
+  size_t num_phases;
+  size_t *queue_starts;  /// Start of the queue of shard k of phase p at [p * num_shards + k], in order.
+  size_t *order;         /// Indices of the commands of every queue.
+  size_t *phase_ends;    /// Index just past the last command of each phase.
+  unsigned int *phase_delays;  /// Delay all threads observe after each phase.
+};
+
+/// Parses a whole job file into a command stream.
+/// @note Large files are split at line boundaries and parsed by several threads.
+/// @param file Job file to compile.
+/// @param max_parsers Maximum number of parsing threads.
+/// @param stream Command stream to be filled.
+/// @return 0 if the file was compiled successfully, 1 otherwise.
+int compile_job_file(struct JobFile *file, int max_parsers, struct CommandStream *stream);
+
+/// Splits the decoded commands of a stream into segments and marks its runs of RESERVEs.
+/// @param stream Command stream whose commands and seats are filled.
+/// @return 0 if the stream was indexed successfully, 1 otherwise.
+int index_command_stream(struct CommandStream *stream);
+
+/// Assigns the commands of a stream to shards.
+/// @note Commands on the same event always land on the same shard, so each event is only touched
+///       by one thread between two fences. A targeted WAIT goes to the shard of its thread.
+/// @param stream Compiled command stream.
+/// @param num_shards Number of shards, one per thread.
+/// @param plan Plan to be filled.
+/// @return 0 if the plan was built successfully, 1 otherwise.
+int plan_shards(struct CommandStream *stream, size_t num_shards, struct ShardPlan *plan);
+
+/// Releases the memory of a shard plan.
+void free_shard_plan(struct ShardPlan *plan);
+
+/// Releases the memory of a command stream.
+/// @param stream Command stream to be released.
+void free_command_stream(struct CommandStream *stream);
+
+#endif  // EMS_COMMANDS_H
@@ -1,2 +1 @@
-#define MAX_RESERVATION_SIZE 256
 #define STATE_ACCESS_DELAY_MS 10
@@ -1,78 +1,290 @@
 #include "eventlist.h"
 #include "auxFunctions.h"
+#include "stats.h"
 
+#include <sched.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
 
-struct EventList* create_list() {
-  struct EventList* list = (struct EventList*)malloc(sizeof(struct EventList));
+static size_t bucket_of(unsigned int event_id, size_t mask) {
+  // Fibonacci hashing spreads consecutive ids over the slots, as long as the slot comes from the high bits of
+  // the product: its low bits only depend on the low bits of the id, so multiples of 65536 would all collide
+  return (size_t)(((uint64_t)(uint32_t)(event_id * 2654435761u) * (mask + 1)) >> 32);
+}
+
+/// Counter of the lookups in progress this thread uses, picked on its first lookup.
+static _Thread_local size_t reader_slot = SIZE_MAX;
+static atomic_uint next_reader_slot = 0;
+
+static struct EventTable* alloc_table(struct SharedArena* arena, size_t num_slots) {
+  struct EventTable* table =
+      (struct EventTable*)arena_alloc(arena, sizeof(struct EventTable) + num_slots * sizeof(struct Event*));
+  if (!table) return NULL;
+  table->mask = num_slots - 1;
+  return table;
+}
+
+struct EventList* create_list(struct SharedArena* arena) {
+  // The reader counters are cache line aligned, so the list is too
+  struct EventList* list = (struct EventList*)arena_alloc_block(arena, sizeof(struct EventList));
   if (!list) return NULL;
-  list->head = NULL;
-  list->tail = NULL;
+  list->arena = arena;
+
+  struct EventTable* table = alloc_table(arena, EVENT_INITIAL_SLOTS);
+  if (!table) {
+    arena_free_block(arena, list, sizeof(struct EventList));
+    return NULL;
+  }
+  atomic_init(&list->table, table);
+  list->num_hashed = 0;
   return list;
 }
 
-int append_to_list(struct EventList* list, struct Event* event) {
+/// Enters a lookup of the id table.
+/// @note The epoch is read again after counting the lookup, so the lookup is counted under the parity
+///       the epoch had when it started and wait_for_readers can not miss it.
+/// @return Counter to be given to leave_table.
+static atomic_size_t* enter_table(struct EventList* list) {
+  if (reader_slot == SIZE_MAX) {
+    // Processes sharing a list start from different slots
+    reader_slot = (atomic_fetch_add_explicit(&next_reader_slot, 1, memory_order_relaxed) +
+                   bucket_of((unsigned int)getpid(), EVENT_READER_SLOTS - 1)) % EVENT_READER_SLOTS;
+  }
+
+  struct ReaderSlot* slot = &list->readers[reader_slot];
+  while (1) {
+    size_t epoch = atomic_load(&list->epoch);
+    atomic_size_t* active = &slot->active[epoch & 1];
+    atomic_fetch_add(active, 1);
+    if (atomic_load(&list->epoch) == epoch) return active;
+    atomic_fetch_sub_explicit(active, 1, memory_order_release);
+  }
+}
+
+static void leave_table(atomic_size_t* active) { atomic_fetch_sub_explicit(active, 1, memory_order_release); }
+
+/// Waits until every lookup that may have seen a table replaced before this call is over.
+/// @note Lookups entering from now on count under the other parity, so only the ones already
+///       in progress are waited for, and they only probe a few slots.
+static void wait_for_readers(struct EventList* list) {
+  uint64_t start = stats_clock();
+  size_t parity = atomic_fetch_add(&list->epoch, 1) & 1;
+  for (size_t i = 0; i < EVENT_READER_SLOTS; i++) {
+    while (atomic_load(&list->readers[i].active[parity]) != 0) {
+      sched_yield();
+    }
+  }
+  stats_lock_wait(STATS_LOCK_DIRECTORY, start);
+}
+
+/// Stores an event in the first free slot of its probe sequence.
+static void insert_into_table(struct EventTable* table, struct Event* event) {
+  size_t i = bucket_of(event->id, table->mask);
+  while (atomic_load_explicit(&table->slots[i], memory_order_relaxed)) {
+    i = (i + 1) & table->mask;
+  }
+  atomic_store_explicit(&table->slots[i], event, memory_order_release);
+}
+
+/// Replaces the id table with one twice as large, then reclaims the old one once no lookup uses it.
+static int grow_table(struct EventList* list) {
+  struct EventTable* old = atomic_load_explicit(&list->table, memory_order_relaxed);
+  struct EventTable* table = alloc_table(list->arena, (old->mask + 1) * 2);
+  if (!table) return 1;
+
+  for (size_t i = 0; i <= old->mask; i++) {
+    struct Event* event = atomic_load_explicit(&old->slots[i], memory_order_relaxed);
+    if (event) insert_into_table(table, event);
+  }
+
+  atomic_store(&list->table, table);
+  wait_for_readers(list);
+  arena_free(list->arena, old);
+  return 0;
+}
+
+int append_to_list(struct EventList* list, struct Event* event, size_t order) {
   if (!list) return 1;
 
-  struct ListNode* new_node = (struct ListNode*)malloc(sizeof(struct ListNode));
+  // Keep the load factor at most 1/2 so probe sequences stay short
+  struct EventTable* table = atomic_load_explicit(&list->table, memory_order_relaxed);
+  if (event->id >= EVENT_DIRECT_SIZE && (list->num_hashed + 1) * 2 > table->mask + 1 && grow_table(list) != 0) {
+    return 1;
+  }
+
+  struct ListNode* new_node = (struct ListNode*)arena_alloc(list->arena, sizeof(struct ListNode));
   if (!new_node) return 1;
 
+  // Nodes arrive nearly in order, so the place of the new one is found walking back from the tail
+  struct ListNode* tail = atomic_load_explicit(&list->tail, memory_order_relaxed);
+  struct ListNode* prev = tail;
+  while (prev != NULL && prev->order > order) {
+    prev = prev->prev;
+  }
+  struct ListNode* next = prev != NULL ? atomic_load_explicit(&prev->next, memory_order_relaxed)
+                                       : atomic_load_explicit(&list->head, memory_order_relaxed);
+
   new_node->event = event;
-  new_node->next = NULL;
+  new_node->order = order;
+  new_node->prev = prev;
+  atomic_init(&new_node->next, next);
+
+  // The node is complete before it is linked, so a walk that reaches it can go on past it
+  if (prev == NULL) {
+    atomic_store_explicit(&list->head, new_node, memory_order_release);
+  } else {
+    atomic_store_explicit(&prev->next, new_node, memory_order_release);
+  }
+
+  // The tail is published last, so a reader that sees it can follow every link up to it
+  if (next == NULL) {
+    atomic_store_explicit(&list->tail, new_node, memory_order_release);
+  } else {
+    next->prev = new_node;
+  }
 
-  if (list->head == NULL) {
-    list->head = new_node;
-    list->tail = new_node;
+  if (event->id < EVENT_DIRECT_SIZE) {
+    atomic_store_explicit(&list->direct[event->id], event, memory_order_release);
   } else {
-    list->tail->next = new_node;
-    list->tail = new_node;
+    insert_into_table(atomic_load_explicit(&list->table, memory_order_relaxed), event);
+    list->num_hashed++;
   }
 
   return 0;
 }
 
-static void free_event(struct Event* event) {
+struct Event* alloc_event(struct SharedArena* arena, size_t num_rows, size_t num_cols) {
+  size_t num_seats = num_rows * num_cols;
+  if (num_cols != 0 && num_seats / num_cols != num_rows) return NULL;
+
+  // Sparse events only keep a directory of page tables next to the header
+  int sparse = num_seats >= (arena != NULL ? SEAT_SPARSE_MIN_SHARED_SEATS : SEAT_SPARSE_MIN_SEATS);
+  size_t seats_per_table = (size_t)SEAT_PAGE_SEATS * SEAT_TABLE_PAGES;
+  size_t num_tables = sparse ? num_seats / seats_per_table + (num_seats % seats_per_table != 0) : 0;
+  size_t entry_size = sparse ? sizeof(_Atomic(struct SeatTable*)) : sizeof(atomic_uint);
+  size_t num_entries = sparse ? num_tables : num_seats;
+  if (num_entries > (SIZE_MAX - sizeof(struct Event)) / entry_size) return NULL;
+
+  // The header is a whole number of cache lines, so the seats start on a line of their own
+  size_t block_size = sizeof(struct Event) + num_entries * entry_size;
+  struct Event* event = (struct Event*)arena_alloc_block(arena, block_size);
+  if (!event) return NULL;
+
+  event->rows = num_rows;
+  event->cols = num_cols;
+  if (sparse) {
+    event->tables = (_Atomic(struct SeatTable*)*)(event + 1);
+    event->num_tables = num_tables;
+  } else {
+    event->data = (atomic_uint*)(event + 1);
+  }
+  event->block_size = block_size;
+  return event;
+}
+
+void release_event(struct SharedArena* arena, struct Event* event) {
+  for (size_t t = 0; t < event->num_tables; t++) {
+    struct SeatTable* table = atomic_load_explicit(&event->tables[t], memory_order_relaxed);
+    if (!table) continue;
+
+    for (size_t p = 0; p < SEAT_TABLE_PAGES; p++) {
+      arena_free_block(arena, atomic_load_explicit(&table->pages[p], memory_order_relaxed), sizeof(struct SeatPage));
+    }
+    arena_free_block(arena, table, sizeof(struct SeatTable));
+  }
+
+  arena_free_block(arena, event, event->block_size);
+}
+
+/// Gets an entry of a sparse event, installing a zeroed block in it when it is empty.
+/// @note Concurrent reservations may race to install a block, the losers release theirs.
+/// @return Block held by the entry, NULL on failure.
+static void* install_block(struct SharedArena* arena, void* _Atomic* entry, size_t size) {
+  void* block = atomic_load_explicit(entry, memory_order_acquire);
+  if (block) return block;
+
+  void* fresh = arena_alloc_block(arena, size);
+  if (!fresh) return NULL;
+
+  if (atomic_compare_exchange_strong_explicit(entry, &block, fresh, memory_order_acq_rel, memory_order_acquire)) {
+    return fresh;
+  }
+  arena_free_block(arena, fresh, size);
+  return block;
+}
+
+atomic_uint* seat_slot(struct SharedArena* arena, struct Event* event, size_t index) {
+  if (event->data) return &event->data[index];
+
+  size_t page = index / SEAT_PAGE_SEATS;
+  struct SeatTable* table = install_block(arena, (void* _Atomic*)&event->tables[page / SEAT_TABLE_PAGES],
+                                          sizeof(struct SeatTable));
+  if (!table) return NULL;
+
+  struct SeatPage* seats = install_block(arena, (void* _Atomic*)&table->pages[page % SEAT_TABLE_PAGES],
+                                         sizeof(struct SeatPage));
+  if (!seats) return NULL;
+
+  return &seats->seats[index % SEAT_PAGE_SEATS];
+}
+
+unsigned int seat_load(struct Event* event, size_t index) {
+  if (event->data) return atomic_load_explicit(&event->data[index], memory_order_relaxed);
+
+  // Seats of pages that were never allocated are free
+  size_t page = index / SEAT_PAGE_SEATS;
+  struct SeatTable* table = atomic_load_explicit(&event->tables[page / SEAT_TABLE_PAGES], memory_order_acquire);
+  if (!table) return 0;
+
+  struct SeatPage* seats = atomic_load_explicit(&table->pages[page % SEAT_TABLE_PAGES], memory_order_acquire);
+  if (!seats) return 0;
+
+  return atomic_load_explicit(&seats->seats[index % SEAT_PAGE_SEATS], memory_order_relaxed);
+}
+
+static void free_event(struct SharedArena* arena, struct Event* event) {
   if (!event) return;
 
   if (pthread_rwlock_destroy(&event->rwlock) != 0) {
     fprintf(stderr, "Erro ao destruir a read-write lock do evento\n");
   }
 
-  if (pthread_mutex_destroy(&event->mutex) != 0) {
-    fprintf(stderr, "Erro ao destruir o mutex do evento\n");
-  }
-
-  freeMutexes(event, event->rows, event->cols);
-  free(event->data);
-  free(event);
+  release_event(arena, event);
 }
 
 void free_list(struct EventList* list) {
   if (!list) return;
 
-  struct ListNode* current = list->head;
+  struct ListNode* current = atomic_load_explicit(&list->head, memory_order_relaxed);
   while (current) {
     struct ListNode* temp = current;
-    current = current->next;
+    current = atomic_load_explicit(&current->next, memory_order_relaxed);
 
-    free_event(temp->event);
-    free(temp);
+    free_event(list->arena, temp->event);
+    arena_free(list->arena, temp);
   }
 
-  free(list);
+  arena_free(list->arena, atomic_load_explicit(&list->table, memory_order_relaxed));
+  arena_free_block(list->arena, list, sizeof(struct EventList));
 }
 
 struct Event* get_event(struct EventList* list, unsigned int event_id) {
   if (!list) return NULL;
-  struct ListNode* current = list->head;
-  while (current) {
-    struct Event* event = current->event;
-    if (event->id == event_id) {
-      return event;
+  if (event_id < EVENT_DIRECT_SIZE) return atomic_load_explicit(&list->direct[event_id], memory_order_acquire);
+
+  atomic_size_t* active = enter_table(list);
+  struct EventTable* table = atomic_load(&list->table);
+  struct Event* found = NULL;
+  for (size_t i = bucket_of(event_id, table->mask);; i = (i + 1) & table->mask) {
+    struct Event* event = atomic_load_explicit(&table->slots[i], memory_order_acquire);
+    if (!event || event->id == event_id) {
+      found = event;
+      break;
     }
-    current = current->next;
   }
+  leave_table(active);
 
-  return NULL;
+  return found;
 }
@@ -2,49 +2,145 @@
 #define EVENT_LIST_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <stdatomic.h>
 
+#include "shared.h"
+
+#define SEAT_PAGE_SEATS 1024                       // Seats in each page of a sparse event
+#define SEAT_TABLE_PAGES 512                       // Pages in each table of a sparse event
+#define SEAT_SPARSE_MIN_SEATS ((size_t)1 << 24)    // Venues this large only get memory for the seats in use
+#define SEAT_SPARSE_MIN_SHARED_SEATS ((size_t)SEAT_PAGE_SEATS * SEAT_TABLE_PAGES)  // The same in a shared arena
+#define SEAT_TENTATIVE 0x80000000u                 // Set on the seats of a reservation still claiming the rest
+
+#define EVENT_SEQ_WRITER ((uint64_t)1)                // Added to Event.seq by each RESERVE batch in progress
+#define EVENT_SEQ_GENERATION ((uint64_t)1 << 32)      // Added to Event.seq by each RESERVE batch that ends
+#define EVENT_SEQ_WRITERS (EVENT_SEQ_GENERATION - 1)  // Bits of Event.seq counting the batches in progress
+
+/// Page of seats of a sparse event, allocated on its first reservation.
+struct SeatPage {
+  atomic_uint seats[SEAT_PAGE_SEATS];
+};
+
+/// Table of pages of a sparse event, allocated with its first page.
+struct SeatTable {
+  _Atomic(struct SeatPage*) pages[SEAT_TABLE_PAGES];
+};
+
+/// Events live in one cache line aligned block: this header, then the seats.
 struct Event {
   unsigned int id;            /// Event id
-  atomic_uint reservations;  /// Number of reservations for the event.
-  pthread_mutex_t mutex;
   pthread_rwlock_t rwlock;
-  pthread_mutex_t *seatsLock;
 
   size_t cols;  /// Number of columns.
   size_t rows;  /// Number of rows.
 
-  unsigned int* data;  /// Array of size rows * cols with the reservations for each seat.
+  atomic_uint* data;  /// Array of size rows * cols with the reservations for each seat, claimed with CAS.
+                      /// NULL for sparse events.
+  _Atomic(struct SeatTable*)* tables;  /// Page tables of a sparse event, NULL for dense events.
+  size_t num_tables;
+  size_t block_size;  /// Size of the block holding the event.
+
+  _Alignas(64) atomic_uint reservations;  /// Number of reservations for the event, on a line of its own.
+  _Atomic uint64_t seq;  /// Sequence lock of the seats: RESERVE batches in progress in the low 32 bits, batches
+                         /// finished in the high 32 bits. SHOW copies the seats without locking and retries if
+                         /// it changed.
 };
 
+/// Ids below this value are looked up directly, without hashing.
+#define EVENT_DIRECT_SIZE 1024
+/// Initial number of slots of the id table for the remaining ids (power of two).
+#define EVENT_INITIAL_SLOTS 64
+/// Counters of the lookups in progress, threads are spread over them.
+#define EVENT_READER_SLOTS 64
+
 struct ListNode {
   struct Event* event;
-  struct ListNode* next;
+  _Atomic(struct ListNode*) next;  /// Next event in creation order.
+  struct ListNode* prev;           /// Previous event, only followed by the writer.
+  size_t order;                    /// Key the list is sorted by, see append_to_list.
+};
+
+/// Open addressing table of the events with ids >= EVENT_DIRECT_SIZE, at most half full.
+/// @note Never changed in place once replaced by a larger one; the old table is freed once no lookup can
+///       still be reading it.
+struct EventTable {
+  size_t mask;                      /// Number of slots minus one.
+  _Atomic(struct Event*) slots[];   /// Events by hashed id, probed linearly up to the first NULL.
+};
+
+/// Lookups in progress that entered in an even or odd epoch, on a cache line of their own.
+struct ReaderSlot {
+  _Alignas(64) atomic_size_t active[2];
 };
 
-// Linked list structure
+// Event directory: creation-ordered list plus an id index.
+// Lookups take no lock: events are published with release stores and stay until the list is freed. Writers
+// (CREATEs) must be serialized by the caller.
 struct EventList {
-  struct ListNode* head;  // Head of the list
-  struct ListNode* tail;  // Tail of the list
+  _Atomic(struct ListNode*) head;  // Head of the list
+  _Atomic(struct ListNode*) tail;  // Tail of the list, published after the link to it
+
+  _Atomic(struct Event*) direct[EVENT_DIRECT_SIZE];  // Events with small ids, indexed by id
+  _Atomic(struct EventTable*) table;                 // Id table for ids >= EVENT_DIRECT_SIZE
+  size_t num_hashed;                                 // Number of events stored in the table
+
+  atomic_size_t epoch;                               // Bumped each time a replaced table is reclaimed
+  struct ReaderSlot readers[EVENT_READER_SLOTS];     // Lookups in progress, by epoch parity
+
+  struct SharedArena* arena;                         // Where nodes and events are allocated, NULL for the heap
 };
 
 /// Creates a new event list.
+/// @param arena Shared arena holding the list and its events, NULL to use the heap.
 /// @return Newly created event list, NULL on failure
-struct EventList* create_list();
+struct EventList* create_list(struct SharedArena* arena);
+
+/// Allocates a zeroed event with its seats.
+/// @note Large venues get fresh pages straight from mmap, which come zeroed for free. Venues of
+///       SEAT_SPARSE_MIN_SEATS seats or more are sparse: only the pages holding reserved seats are allocated.
+///       In a shared arena, whose space is never given back, venues of SEAT_SPARSE_MIN_SHARED_SEATS are.
+/// @param arena Shared arena holding the event, NULL to use the heap.
+/// @param num_rows Number of rows.
+/// @param num_cols Number of columns.
+/// @return Newly allocated event, NULL on failure.
+struct Event* alloc_event(struct SharedArena* arena, size_t num_rows, size_t num_cols);
+
+/// Releases the memory of an event that was never added to a list.
+/// @param arena Arena the event was allocated from.
+/// @param event Event to be released.
+void release_event(struct SharedArena* arena, struct Event* event);
+
+/// Gets a seat to be claimed, allocating its page if the event is sparse.
+/// @param arena Arena the event was allocated from.
+/// @param event Event to get the seat from.
+/// @param index Index of the seat.
+/// @return Pointer to the seat, NULL on failure.
+atomic_uint* seat_slot(struct SharedArena* arena, struct Event* event, size_t index);
+
+/// Reads the reservation of a seat, without allocating anything.
+/// @param event Event to read the seat from.
+/// @param index Index of the seat.
+/// @return Id of the reservation holding the seat, 0 if it is free.
+unsigned int seat_load(struct Event* event, size_t index);
 
-/// Appends a new node to the list.
+/// Adds a new node to the list, making the event visible to lookups.
+/// @note Calls must be serialized; they may run alongside any number of lookups and walks of the list.
+///       The node goes after every node with an order no larger than its own, so events created out of
+///       order are put back in place. A walk that started before may or may not see it.
 /// @param list Event list to be modified.
 /// @param data Event to be stored in the new node.
-/// @return 0 if the node was appended successfully, 1 otherwise.
-int append_to_list(struct EventList* list, struct Event* data);
+/// @param order Key of the node, SIZE_MAX to always append it.
+/// @return 0 if the node was added successfully, 1 otherwise.
+int append_to_list(struct EventList* list, struct Event* data, size_t order);
 
 /// Removes a node from the list.
 /// @param list Event list to be modified.
 /// @return 0 if the node was removed successfully, 1 otherwise.
 void free_list(struct EventList* list);
 
-/// Retrieves an event in the list.
+/// Retrieves an event in the list in constant expected time, without taking any lock.
 /// @param list Event list to be searched
 /// @param event_id Event id.
 /// @return Pointer to the event if found, NULL otherwise.
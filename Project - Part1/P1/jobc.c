@@ -0,0 +1,89 @@
+#include "commands.h"
+#include "jobformat.h"
+#include "parser.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Function that creates the path of the compiled file, next to the source */
+static char *pathingCompiled(const char *pathJobs) {
+  size_t len = strlen(pathJobs);
+  if (len >= 5 && strcmp(pathJobs + len - 5, ".jobs") == 0) len -= 5;
+
+  char *pathCompiled = malloc(len + strlen(".jobc") + 1);
+  if (pathCompiled == NULL) {
+    fprintf(stderr, "Error: Failed to allocate memory\n");
+    return NULL;
+  }
+  memcpy(pathCompiled, pathJobs, len);
+  strcpy(pathCompiled + len, ".jobc");
+  return pathCompiled;
+}
+
+/* Function that compiles one job file */
+static int compile_file(const char *pathJobs, int max_parsers) {
+  struct JobFile jobFile;
+  if (open_job_file(&jobFile, pathJobs) != 0) {
+    perror("Error opening input file");
+    return 1;
+  }
+
+  struct CommandStream stream;
+  int failed = compile_job_file(&jobFile, max_parsers, &stream);
+  close_job_file(&jobFile);
+  if (failed) {
+    fprintf(stderr, "Error parsing input file: %s\n", pathJobs);
+    return 1;
+  }
+
+  char *data;
+  size_t size;
+  failed = encode_jobc(&stream, &data, &size);
+  free_command_stream(&stream);
+  if (failed) {
+    return 1;
+  }
+
+  char *pathCompiled = pathingCompiled(pathJobs);
+  FILE *file = pathCompiled != NULL ? fopen(pathCompiled, "wb") : NULL;
+  if (file == NULL) {
+    if (pathCompiled != NULL) perror("Error opening output file");
+    free(pathCompiled);
+    free(data);
+    return 1;
+  }
+
+  if (fwrite(data, 1, size, file) != size) {
+    perror("Error writing output file");
+    failed = 1;
+  }
+  if (fclose(file) != 0 && !failed) {
+    perror("Error writing output file");
+    failed = 1;
+  }
+
+  free(pathCompiled);
+  free(data);
+  return failed;
+}
+
+/* Main function that compiles every job file given into a .jobc file next to it */
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <file.jobs>...\n", argv[0]);
+    return 1;
+  }
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int max_parsers = cpus > 0 ? (int)cpus : 1;
+
+  int failed = 0;
+  for (int i = 1; i < argc; i++) {
+    if (compile_file(argv[i], max_parsers) != 0) {
+      failed = 1;
+    }
+  }
+  return failed;
+}
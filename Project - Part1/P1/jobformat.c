@@ -0,0 +1,289 @@
+#include "jobformat.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VARINT_MAX_BYTES 10  // Bytes of the longest 64 bit varint
+
+int is_jobc_path(const char *path) {
+  size_t len = strlen(path);
+  return len >= 5 && strcmp(path + len - 5, ".jobc") == 0;
+}
+
+/// FNV-1a over 64 bit words, the tail is folded in a byte at a time.
+static uint64_t checksum(const unsigned char *data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * 0x100000001b3ull;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ data[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+static void put_u64(unsigned char *dest, uint64_t value) {
+  for (size_t i = 0; i < 8; i++) {
+    dest[i] = (unsigned char)(value >> (8 * i));
+  }
+}
+
+static uint64_t get_u64(const unsigned char *src) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < 8; i++) {
+    value |= (uint64_t)src[i] << (8 * i);
+  }
+  return value;
+}
+
+static unsigned char *put_varint(unsigned char *dest, uint64_t value) {
+  while (value >= 0x80) {
+    *dest++ = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  *dest++ = (unsigned char)value;
+  return dest;
+}
+
+/// Reads a varint, without going past the end.
+/// @return 0 if the varint was read successfully and fits in max, 1 otherwise.
+static int get_varint(const unsigned char **src, const unsigned char *end, uint64_t max, uint64_t *value) {
+  uint64_t result = 0;
+  for (unsigned int shift = 0; shift < 64 && *src < end; shift += 7) {
+    unsigned char byte = *(*src)++;
+    result |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return result > max;
+    }
+  }
+  return 1;
+}
+
+int encode_jobc(struct CommandStream *stream, char **data, size_t *size) {
+  // Every command takes at most an opcode and three varints, every seat two varints
+  size_t bound = JOBC_HEADER_SIZE + stream->num_commands * (1 + 3 * VARINT_MAX_BYTES) +
+                 stream->num_coords * 2 * VARINT_MAX_BYTES;
+  unsigned char *buffer = malloc(bound);
+  if (buffer == NULL) {
+    fprintf(stderr, "Error: Failed to allocate memory\n");
+    return 1;
+  }
+
+  unsigned char *current = buffer + JOBC_HEADER_SIZE;
+  for (size_t i = 0; i < stream->num_commands; i++) {
+    struct JobCommand *command = &stream->commands[i];
+    *current++ = (unsigned char)command->type;
+
+    switch (command->type) {
+      case CMD_CREATE:
+        current = put_varint(current, command->event_id);
+        current = put_varint(current, command->num_rows);
+        current = put_varint(current, command->num_cols);
+        break;
+
+      case CMD_RESERVE:
+        current = put_varint(current, command->event_id);
+        current = put_varint(current, command->num_coords);
+        break;
+
+      case CMD_SHOW:
+        current = put_varint(current, command->event_id);
+        break;
+
+      case CMD_WAIT:
+        current = put_varint(current, command->delay);
+        current = put_varint(current, command->thread_id);
+        break;
+
+      case CMD_LIST_EVENTS:
+      case CMD_BARRIER:
+      case CMD_HELP:
+      case CMD_EMPTY:
+      case CMD_INVALID:
+      case EOC:
+        break;
+    }
+  }
+  size_t commands_size = (size_t)(current - buffer) - JOBC_HEADER_SIZE;
+
+  // Rows first, then columns, following the RESERVEs in file order
+  unsigned char *coords = current;
+  for (int axis = 0; axis < 2; axis++) {
+    size_t *values = axis == 0 ? stream->xs : stream->ys;
+    for (size_t i = 0; i < stream->num_commands; i++) {
+      struct JobCommand *command = &stream->commands[i];
+      if (command->type != CMD_RESERVE) continue;
+
+      for (size_t k = 0; k < command->num_coords; k++) {
+        current = put_varint(current, values[command->coords + k]);
+      }
+    }
+  }
+
+  memcpy(buffer, JOBC_MAGIC, strlen(JOBC_MAGIC));
+  buffer[strlen(JOBC_MAGIC)] = JOBC_VERSION;
+  put_u64(buffer + 8, stream->num_commands);
+  put_u64(buffer + 16, stream->num_coords);
+  put_u64(buffer + 24, commands_size);
+  put_u64(buffer + 32, (uint64_t)(current - coords));
+  put_u64(buffer + 40, checksum(buffer + JOBC_HEADER_SIZE, (size_t)(current - buffer) - JOBC_HEADER_SIZE));
+
+  *data = (char *)buffer;
+  *size = (size_t)(current - buffer);
+  return 0;
+}
+
+/// Checks the header of a compiled job file against its size and contents.
+/// @return 0 if the header is valid, 1 otherwise.
+static int read_header(struct JobFile *file, struct JobcHeader *header) {
+  const unsigned char *data = (const unsigned char *)file->data;
+  if (file->size < JOBC_HEADER_SIZE || memcmp(data, JOBC_MAGIC, strlen(JOBC_MAGIC)) != 0 ||
+      data[strlen(JOBC_MAGIC)] != JOBC_VERSION) {
+    return 1;
+  }
+
+  header->num_commands = get_u64(data + 8);
+  header->num_coords = get_u64(data + 16);
+  header->commands_size = get_u64(data + 24);
+  header->coords_size = get_u64(data + 32);
+  header->checksum = get_u64(data + 40);
+
+  // Every command takes at least a byte and every seat two, which bounds the allocations
+  size_t payload = file->size - JOBC_HEADER_SIZE;
+  if (header->commands_size > payload || header->coords_size != payload - header->commands_size ||
+      header->num_commands > header->commands_size || header->num_coords > header->coords_size / 2) {
+    return 1;
+  }
+
+  return checksum(data + JOBC_HEADER_SIZE, payload) != header->checksum;
+}
+
+/// Decodes the commands section into the stream.
+/// @return 0 if every command was decoded successfully, 1 otherwise.
+static int decode_commands(const unsigned char *src, const unsigned char *end, struct CommandStream *stream,
+                           size_t num_coords) {
+  size_t coords = 0;
+  for (size_t i = 0; i < stream->num_commands; i++) {
+    struct JobCommand *command = &stream->commands[i];
+    memset(command, 0, sizeof(struct JobCommand));
+    if (src == end) return 1;
+
+    uint64_t id = 0, first = 0, second = 0;
+    switch (*src++) {
+      case CMD_CREATE:
+        command->type = CMD_CREATE;
+        if (get_varint(&src, end, UINT_MAX, &id) || get_varint(&src, end, UINT_MAX, &first) ||
+            get_varint(&src, end, UINT_MAX, &second)) {
+          return 1;
+        }
+        command->event_id = (unsigned int)id;
+        command->num_rows = (size_t)first;
+        command->num_cols = (size_t)second;
+        break;
+
+      case CMD_RESERVE:
+        command->type = CMD_RESERVE;
+        if (get_varint(&src, end, UINT_MAX, &id) || get_varint(&src, end, num_coords - coords, &first)) {
+          return 1;
+        }
+        command->event_id = (unsigned int)id;
+        command->num_coords = (size_t)first;
+        command->coords = coords;
+        coords += command->num_coords;
+        break;
+
+      case CMD_SHOW:
+        command->type = CMD_SHOW;
+        if (get_varint(&src, end, UINT_MAX, &id)) return 1;
+        command->event_id = (unsigned int)id;
+        break;
+
+      case CMD_WAIT:
+        command->type = CMD_WAIT;
+        if (get_varint(&src, end, UINT_MAX, &first) || get_varint(&src, end, UINT_MAX, &second)) return 1;
+        command->delay = (unsigned int)first;
+        command->thread_id = (unsigned int)second;
+        break;
+
+      case CMD_LIST_EVENTS:
+        command->type = CMD_LIST_EVENTS;
+        break;
+
+      case CMD_BARRIER:
+        command->type = CMD_BARRIER;
+        break;
+
+      case CMD_HELP:
+        command->type = CMD_HELP;
+        break;
+
+      case CMD_INVALID:
+        command->type = CMD_INVALID;
+        break;
+
+      default:
+        return 1;
+    }
+  }
+
+  return src != end || coords != num_coords;
+}
+
+int load_jobc(struct JobFile *file, struct CommandStream *stream) {
+  memset(stream, 0, sizeof(struct CommandStream));
+
+  struct JobcHeader header;
+  if (read_header(file, &header) != 0) {
+    fprintf(stderr, "Invalid compiled job file.\n");
+    return 1;
+  }
+
+  stream->commands = malloc((size_t)(header.num_commands + 1) * sizeof(struct JobCommand));
+  stream->xs = malloc((size_t)(header.num_coords + 1) * sizeof(size_t));
+  stream->ys = malloc((size_t)(header.num_coords + 1) * sizeof(size_t));
+  if (stream->commands == NULL || stream->xs == NULL || stream->ys == NULL) {
+    fprintf(stderr, "Error allocating memory for the commands.\n");
+    free_command_stream(stream);
+    return 1;
+  }
+  stream->num_commands = (size_t)header.num_commands;
+  stream->num_coords = (size_t)header.num_coords;
+
+  const unsigned char *commands = (const unsigned char *)file->data + JOBC_HEADER_SIZE;
+  const unsigned char *coords = commands + header.commands_size;
+  const unsigned char *end = coords + header.coords_size;
+
+  int result = decode_commands(commands, coords, stream, stream->num_coords);
+  for (size_t i = 0; i < stream->num_coords && result == 0; i++) {
+    uint64_t value = 0;
+    result = get_varint(&coords, end, UINT_MAX, &value);
+    stream->xs[i] = (size_t)value;
+  }
+  for (size_t i = 0; i < stream->num_coords && result == 0; i++) {
+    uint64_t value = 0;
+    result = get_varint(&coords, end, UINT_MAX, &value);
+    stream->ys[i] = (size_t)value;
+  }
+  if (result == 0 && coords != end) result = 1;
+
+  if (result != 0) {
+    fprintf(stderr, "Invalid compiled job file.\n");
+    free_command_stream(stream);
+    return 1;
+  }
+
+  if (index_command_stream(stream) != 0) {
+    fprintf(stderr, "Error allocating memory for the commands.\n");
+    free_command_stream(stream);
+    return 1;
+  }
+
+  file->pos = file->size;
+  return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef EMS_JOBFORMAT_H
+#define EMS_JOBFORMAT_H
+
+#include "commands.h"
+#include "parser.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define JOBC_MAGIC "EMSJOBC"  // First bytes of every compiled job file, followed by the version byte
+#define JOBC_VERSION 1
+#define JOBC_HEADER_SIZE 48   // Magic, version and the five little endian fields of JobcHeader
+
+/// Compiled job file (.jobc) layout, after the header:
+///   commands: one opcode byte per command (its enum Command value), followed by its varints:
+///             CREATE id rows cols, RESERVE id num_seats, SHOW id, WAIT delay thread_id.
+///   rows:     varint row of every seat of every RESERVE, in file order.
+///   cols:     varint column of every seat, in the same order.
+/// Varints are unsigned LEB128. The header holds the number of commands and seats, the size of each
+/// section and a checksum of everything after the header.
+struct JobcHeader {
+  uint64_t num_commands;
+  uint64_t num_coords;
+  uint64_t commands_size;  /// Bytes of the commands section.
+  uint64_t coords_size;    /// Bytes of the rows and columns sections together.
+  uint64_t checksum;
+};
+
+/// Checks whether a path names a compiled job file.
+/// @return 1 if the path ends in .jobc, 0 otherwise.
+int is_jobc_path(const char *path);
+
+/// Encodes a command stream in the compiled format.
+/// @param stream Command stream to encode.
+/// @param data Where the newly allocated encoding is stored.
+/// @param size Where the size of the encoding is stored.
+/// @return 0 if the stream was encoded successfully, 1 otherwise.
+int encode_jobc(struct CommandStream *stream, char **data, size_t *size);
+
+/// Decodes a mapped compiled job file into a command stream, without parsing any text.
+/// @param file Compiled job file to decode.
+/// @param stream Command stream to be filled.
+/// @return 0 if the file was decoded successfully, 1 if it is malformed or memory ran out.
+int load_jobc(struct JobFile *file, struct CommandStream *stream);
+
+#endif  // EMS_JOBFORMAT_H
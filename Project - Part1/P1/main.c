@@ -1,7 +1,13 @@
 #include "operations.h"
+#include "affinity.h"
+#include "autotune.h"
 #include "parser.h"
 #include "main.h"
 #include "auxFunctions.h"
+#include "commands.h"
+#include "jobformat.h"
+#include "scheduler.h"
+#include "stats.h"
 
 #include <limits.h>
 #include <stdio.h>
@@ -15,16 +21,89 @@
 #include <string.h>
 #include <sys/wait.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 
 #define ERROR -1
 
 int global_num_proc = 0;
 int global_num_threads = 0;
+unsigned int global_delay_ms = STATE_ACCESS_DELAY_MS;
+struct EMSState *global_shared_state = NULL;
+int global_sharded = 0;
 
 
+/* Function that parses a size in bytes, with an optional K, M or G suffix */
+static int parse_size(const char *text, size_t *size) {
+  char *endptr;
+  unsigned long long value = strtoull(text, &endptr, 10);
+  if (endptr == text || text[0] == '-') {
+    return 1;
+  }
+
+  unsigned int shift = 0;
+  switch (*endptr) {
+    case 'K': shift = 10; endptr++; break;
+    case 'M': shift = 20; endptr++; break;
+    case 'G': shift = 30; endptr++; break;
+    default: break;
+  }
+  if (*endptr != '\0' || value == 0 || value > (SIZE_MAX >> shift)) {
+    return 1;
+  }
+
+  *size = (size_t)value << shift;
+  return 0;
+}
+
 /* Main function that processes the arguments and calls the functions that process the files */
 int main(int argc, char *argv[]) {
-  unsigned int state_access_delay_ms = STATE_ACCESS_DELAY_MS;
+  int use_threads = 0;
+  int use_shared = 0;
+  size_t shared_size = 0;
+  int report_topology = 0;
+
+  // Options come before the positional arguments
+  int option;
+  while ((option = getopt(argc, argv, "tsgm:ear")) != -1) {
+    switch (option) {
+      case 't':
+        use_threads = 1;
+        break;
+      case 's':
+        // Latency and lock wait statistics are written to a .stats file next to each .out
+        stats_enabled = 1;
+        break;
+      case 'g':
+        // Every job file works on the same events, kept in memory shared by all processes
+        use_shared = 1;
+        break;
+      case 'm':
+        // Address space of the shared store, such as 64G; by default as much as the physical memory
+        if (parse_size(optarg, &shared_size) != 0) {
+          fprintf(stderr, "Invalid shared store size\n");
+          return 1;
+        }
+        break;
+      case 'e':
+        // Commands are spread over the threads by event, LIST and BARRIER are fences
+        global_sharded = 1;
+        break;
+      case 'a':
+        // Each process (or file worker with -t) runs on its own share of the CPUs, its threads one CPU each
+        affinity_enabled = 1;
+        break;
+      case 'r':
+        // The CPUs of each NUMA node and of each process are printed before any file is processed
+        report_topology = 1;
+        break;
+      default:
+        fprintf(stderr, "Invalid arguments. See HELP for usage\n");
+        return 1;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
 
   //If the number of arguments is different from 4 or 5, the input is invalid
   if (argc != 4 && argc != 5) {
@@ -32,23 +111,27 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
-  //If the number of processes is invalid, the input is invalid
-  char *endptr_proc;
-  long int num_proc = strtol(argv[2], &endptr_proc, 10);
-  if (*endptr_proc != '\0' || num_proc > INT_MAX || num_proc < 1) {
-    fprintf(stderr, "Invalid processes value or value too large\n");
-    return 1;
+  //If the number of processes is invalid, the input is invalid; "auto" lets ems pick it
+  if (strcmp(argv[2], "auto") != 0) {
+    char *endptr_proc;
+    long int num_proc = strtol(argv[2], &endptr_proc, 10);
+    if (*endptr_proc != '\0' || num_proc > INT_MAX || num_proc < 1) {
+      fprintf(stderr, "Invalid processes value or value too large\n");
+      return 1;
+    }
+    global_num_proc = (int)num_proc;
   }
-  global_num_proc = (int)num_proc;
 
-  //If the number of threads is invalid, the input is invalid
-  char *endptr_threads;
-  long int num_threads = strtol(argv[3], &endptr_threads, 10);
-  if (*endptr_threads != '\0' || num_threads > INT_MAX || num_threads < 1) {
-    fprintf(stderr, "Invalid threads value or value too large\n");
-    return 1;
+  //If the number of threads is invalid, the input is invalid; "auto" lets ems pick it
+  if (strcmp(argv[3], "auto") != 0) {
+    char *endptr_threads;
+    long int num_threads = strtol(argv[3], &endptr_threads, 10);
+    if (*endptr_threads != '\0' || num_threads > INT_MAX || num_threads < 1) {
+      fprintf(stderr, "Invalid threads value or value too large\n");
+      return 1;
+    }
+    global_num_threads = (int)num_threads;
   }
-  global_num_threads = (int)num_threads;
 
   // If there is a fifth argument, the delay value is assigned
   if (argc == 5) {
@@ -60,17 +143,44 @@ int main(int argc, char *argv[]) {
       return 1;
     }
 
-    state_access_delay_ms = (unsigned int)delay;
+    global_delay_ms = (unsigned int)delay;
   }
 
-  if (ems_init(state_access_delay_ms)) {
-    fprintf(stderr, "Failed to initialize EMS\n");
+  // Counts given as "auto" are still 0 here
+  if (autotune_init(argv[1], global_delay_ms, &global_num_proc, &global_num_threads) != 0) {
     return 1;
   }
 
-  iterateFiles(argv[1]);
+  if ((affinity_enabled || report_topology) && affinity_init(global_num_proc) != 0) {
+    return 1;
+  }
+  if (report_topology) {
+    affinity_report();
+  }
 
-  return 0;
+  pid_t owner = getpid();
+  if (use_shared) {
+    global_shared_state = ems_init_shared(global_delay_ms, shared_size != 0 ? shared_size : arena_default_size());
+    if (global_shared_state == NULL) {
+      fprintf(stderr, "Failed to initialize the shared event store\n");
+      return 1;
+    }
+  }
+
+  // With -t the files share one process and <num_proc> is the number of file workers
+  int result = 0;
+  if (use_threads) {
+    result = schedule_files(argv[1], global_num_proc) != 0;
+  } else {
+    iterateFiles(argv[1]);
+  }
+
+  // Only the process that created the shared store may destroy it
+  if (global_shared_state != NULL && getpid() == owner) {
+    ems_terminate(global_shared_state);
+  }
+
+  return result;
 }
 
 /* Function that iterates over the files of a directory */
@@ -87,26 +197,56 @@ int iterateFiles(char* directoryPath) {
   int activeProcesses = 0;
   int status;
 
+  // Each running child holds a slot, which picks its CPUs
+  ChildSlot *slots = calloc((size_t)global_num_proc, sizeof(ChildSlot));
+  if (slots == NULL) {
+    fprintf(stderr, "Error: Failed to allocate memory\n");
+    closedir(dir);
+    return ERROR;
+  }
+
   // Iterate over the files of the directory
   while ((entry = readdir(dir)) != NULL) {
-    if (strstr(entry->d_name, ".job") != NULL) {
+    if (isJobFile(directoryPath, entry)) {
       if (activeProcesses == global_num_proc) {
-        if (wait(&status) == ERROR)
+        pid_t done = wait(&status);
+        if (done == ERROR) {
+          free(slots);
           return ERROR;
+        }
         printf("The process %d has finished because of the WAIT.\n", status);
         activeProcesses--;
+
+        // How long the file took steers the threads of the next ones
+        for (int s = 0; s < global_num_proc; s++) {
+          if (slots[s].pid != done) continue;
+          autotune_record(slots[s].num_threads, slots[s].size, autotune_clock() - slots[s].start_ns);
+          slots[s].pid = 0;
+        }
       }
+      int slot = 0;
+      while (slot < global_num_proc - 1 && slots[slot].pid != 0) slot++;
+
+      char *pathJobs = pathingJobs(directoryPath, entry);
+      struct stat jobStat;
+      slots[slot].size = pathJobs != NULL && stat(pathJobs, &jobStat) == 0 ? (size_t)jobStat.st_size : 0;
+      slots[slot].num_threads = autotune_threads(slots[slot].size);
+      slots[slot].start_ns = autotune_clock();
+
       pid_t pid = fork();
       if (pid < 0) {
         perror("Error forking process");
+        free(pathJobs);
+        free(slots);
         closedir(dir);
         return ERROR;
 
       } else if (pid == 0) { // Child process
-        char *pathJobs = pathingJobs(directoryPath, entry);
+        affinity_pin_group(slot);
         char *pathOut = pathingOut(directoryPath, entry);
-        if (process_file(pathJobs, pathOut) != 0) {
+        if (process_file(pathJobs, pathOut, slots[slot].num_threads) != 0) {
           fprintf(stderr, "Error processing file: %s\n", pathJobs);
+          free(slots);
           closedir(dir);
           return ERROR;
         }
@@ -115,11 +255,14 @@ int iterateFiles(char* directoryPath) {
         exit(0);
 
       } else { // Parent process
+        free(pathJobs);
+        slots[slot].pid = pid;
         ++activeProcesses;
         printf("Number of active processes: %d.\n", activeProcesses);
       }
     }
   }
+  free(slots);
   printf("THE FATHER WILL START WAITING FOR THE CONCLUSION.\n Number of active processes:%d \n", activeProcesses);
   // Wait for all remaining child processes to finish
   while (activeProcesses > 0) {
@@ -133,12 +276,19 @@ int iterateFiles(char* directoryPath) {
   return 0;
 }
 
+/* Function that destroys the events of a file, the shared store outlives every file */
+static void release_state(struct EMSState* state) {
+  if (state != global_shared_state) {
+    ems_terminate(state);
+  }
+}
+
 /* Function that processes the input file and calls the functions that do the operations */
-int process_file(char* pathJobs, char* pathOut) {
+int process_file(char* pathJobs, char* pathOut, int num_threads) {
 
-  // Open input file
-  int fdRead = open(pathJobs, O_RDONLY);
-  if (fdRead == ERROR) {
+  // Map input file
+  struct JobFile jobFile;
+  if (open_job_file(&jobFile, pathJobs) != 0) {
       perror("Error opening input file");
       return ERROR;
   }
@@ -147,287 +297,475 @@ int process_file(char* pathJobs, char* pathOut) {
   int fdWrite = open(pathOut, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
   if (fdWrite == ERROR) {
       perror("Error opening output file");
-      close(fdRead);
+      close_job_file(&jobFile);
       return ERROR;
   }
 
-  size_t xs[global_num_threads][MAX_RESERVATION_SIZE];
-  size_t ys[global_num_threads][MAX_RESERVATION_SIZE];
-  pthread_mutex_t mutex;
+  // Decode every command up front, so the threads never share a parser
+  struct CommandStream stream;
+  uint64_t compileStart = stats_clock();
+  int compiled = is_jobc_path(pathJobs) ? load_jobc(&jobFile, &stream)
+                                        : compile_job_file(&jobFile, num_threads, &stream);
+  if (compiled != 0) {
+    fprintf(stderr, "Error parsing input file.\n");
+    close_job_file(&jobFile);
+    close(fdWrite);
+    return ERROR;
+  }
 
-  if (pthread_mutex_init(&mutex, NULL) != 0) {
-    perror("Error initializing mutex");
-    close(fdRead);
+  if (close_job_file(&jobFile) != 0) {
+    perror("Error closing input file.");
+    free_command_stream(&stream);
     close(fdWrite);
     return ERROR;
   }
 
-  int barrierFlag = 0;
-  unsigned int waitingThread = 0;
-  unsigned int delayWait = 0;
-
-  // Initialize waitFlags
-  int waitFlags[global_num_threads + 1];
-  for (int i = 0; i <= global_num_threads; i++)
-    waitFlags[i] = 0;
-  
-  pthread_t threads[global_num_threads];
-  ThreadParameters threadParameters[global_num_threads];
-
-  int resultadoThread;
-  while (1) {
-    int flagBarrier = 0;
-    for (int i = 0; i < global_num_threads; i++) {
-      threadParameters[i].barrierFlag = &barrierFlag;
-      threadParameters[i].mutex = &mutex;
-      threadParameters[i].waitingThread = &waitingThread;
-      threadParameters[i].delayWait = &delayWait;
-      threadParameters[i].fdRead = fdRead;
-      threadParameters[i].fdWrite = fdWrite;
-      threadParameters[i].xs = xs[i];
-      threadParameters[i].ys = ys[i];
-      threadParameters[i].thread_id = i+1;
-      threadParameters[i].waitFlags = waitFlags;
-      if (pthread_create(&threads[i], NULL, thread_execute, &threadParameters[i]) != 0) {
-        perror("Error creating thread");
-        // Deal with the failure to create the thread, freeing resources and terminating previous threads
-        if (close(fdRead) == ERROR) {
-          perror("Error closing input file.");
-          return ERROR;
-        }
-        if (close(fdWrite) == ERROR) {
-          perror("Error closing output file.");
-          return ERROR;
-        }
-        if (pthread_mutex_destroy(&mutex) != 0) {
-          fprintf(stderr, "Error: Failed to destroy mutex.\n");
-        }
-        return ERROR;
-      }
-    }
-    for (int i = 0; i < global_num_threads; i++) {
-      if (pthread_join(threads[i], (void*)&resultadoThread) != 0) {
-        perror("Error waiting for thread to finish.");
-        // Deal with the failure to join the thread, freeing resources and terminating previous threads
-        if (close(fdRead) == ERROR) {
-          perror("Error closing input file.");
-          return ERROR;
-        }
-        if (close(fdWrite) == ERROR) {
-          perror("Error closing output file.");
-          return ERROR;
-        }
-        if (pthread_mutex_destroy(&mutex) != 0) {
-          fprintf(stderr, "Error: Failed to destroy mutex.\n");
-        }
-        return ERROR;
-      }
-      if (resultadoThread == BARRIER) {
-        flagBarrier = 1;
-      } else if (resultadoThread == ERROR){
-        return ERROR;
-      }
+  // Every file has its own events, unless all files share one store
+  struct EMSState privateState;
+  struct EMSState *state = global_shared_state;
+  if (state == NULL) {
+    state = &privateState;
+    if (ems_init(state, global_delay_ms)) {
+      fprintf(stderr, "Failed to initialize EMS\n");
+      free_command_stream(&stream);
+      close(fdWrite);
+      return ERROR;
     }
-    // If there was a barrier, the threads are restarted
-    if (!flagBarrier) break;
-    else barrierFlag = 0;
-    
+
+    // A sharded pool is the only user of its events, one thread per event
+    state->owned_events = global_sharded;
   }
 
-  if (close(fdRead) == ERROR) {
-    perror("Error closing input file.");
+  WorkerPool pool;
+  pool.state = state;
+  pool.num_threads = num_threads;
+  pool.stream = &stream;
+  pool.sharded = global_sharded;
+  pool.started = 0;
+  pool.tickets = malloc(stream.num_segments * sizeof(atomic_size_t));
+  pool.progress = malloc((size_t)(num_threads + 1) * sizeof(atomic_size_t));
+  pool.waitDelays = malloc((size_t)(num_threads + 1) * sizeof(atomic_uint));
+  if (pool.tickets == NULL || pool.progress == NULL || pool.waitDelays == NULL) {
+    fprintf(stderr, "Error allocating memory for the worker pool.\n");
+    free(pool.tickets);
+    free(pool.progress);
+    free(pool.waitDelays);
+    free_command_stream(&stream);
+    release_state(state);
+    close(fdWrite);
     return ERROR;
   }
-  if (close(fdWrite) == ERROR) {
-    perror("Error closing output file.");
+  for (size_t s = 0; s < stream.num_segments; s++)
+    atomic_init(&pool.tickets[s], stream.segments[s].start);
+  for (int i = 0; i <= num_threads; i++) {
+    atomic_init(&pool.progress[i], i == 0 ? SIZE_MAX : 0);
+    atomic_init(&pool.waitDelays[i], 0);
+  }
+
+  // Threads are numbered from 1, the first buffer is never used
+  if (output_init(&pool.output, fdWrite, (size_t)num_threads + 1, pool.progress) != 0) {
+    free(pool.tickets);
+    free(pool.progress);
+    free(pool.waitDelays);
+    free_command_stream(&stream);
+    release_state(state);
+    close(fdWrite);
+    return ERROR;
+  }
+
+  if (pthread_mutex_init(&pool.startMutex, NULL) != 0 || pthread_cond_init(&pool.startCond, NULL) != 0) {
+    fprintf(stderr, "Error initializing the worker pool.\n");
+    output_destroy(&pool.output);
+    free(pool.tickets);
+    free(pool.progress);
+    free(pool.waitDelays);
+    free_command_stream(&stream);
+    release_state(state);
+    close(fdWrite);
     return ERROR;
   }
-  if (pthread_mutex_destroy(&mutex) != 0) {
+
+  // Slot 0 gathers the totals, the others belong to the pool's threads
+  pool.stats = NULL;
+  if (stats_enabled) {
+    pool.stats = calloc((size_t)num_threads + 1, sizeof(struct ThreadStats));
+    if (pool.stats == NULL) {
+      fprintf(stderr, "Error allocating memory for the statistics.\n");
+    } else {
+      pool.stats[0].compile_ns = stats_clock() - compileStart;
+    }
+  }
+
+  pthread_t threads[num_threads];
+  ThreadParameters threadParameters[num_threads];
+
+  // The threads live for the whole file and meet at a barrier after each segment
+  int result = 0;
+  int created = 0;
+  for (int i = 0; i < num_threads; i++) {
+    threadParameters[i].thread_id = i+1;
+    threadParameters[i].pool = &pool;
+    if (pthread_create(&threads[i], NULL, thread_execute, &threadParameters[i]) != 0) {
+      perror("Error creating thread");
+      result = ERROR;
+      break;
+    }
+    created++;
+  }
+
+  // Threads that were never created do not hold back early flushes
+  for (int i = created + 1; i <= num_threads; i++)
+    atomic_store(&pool.progress[i], SIZE_MAX);
+
+  // The barrier only counts the threads that actually exist
+  int ready = created > 0;
+  if (ready && pthread_barrier_init(&pool.barrier, NULL, (unsigned int)created) != 0) {
+    fprintf(stderr, "Error: Failed to initialize barrier.\n");
+    result = ERROR;
+    ready = 0;
+  }
+
+  // Events are spread over the threads that exist
+  int planned = 0;
+  if (ready && pool.sharded) {
+    planned = plan_shards(&stream, (size_t)created, &pool.plan) == 0;
+    if (!planned) {
+      result = ERROR;
+      ready = 0;
+      pthread_barrier_destroy(&pool.barrier);
+    }
+  }
+
+  if (pthread_mutex_lock(&pool.startMutex) != 0) {
+    fprintf(stderr, "Error: Failed to lock mutex.\n");
+  }
+  pool.started = ready ? 1 : -1;
+  pthread_cond_broadcast(&pool.startCond);
+  if (pthread_mutex_unlock(&pool.startMutex) != 0) {
+    fprintf(stderr, "Error: Failed to unlock mutex.\n");
+  }
+
+  for (int i = 0; i < created; i++) {
+    void *threadResult;
+    if (pthread_join(threads[i], &threadResult) != 0) {
+      perror("Error waiting for thread to finish.");
+      result = ERROR;
+    } else if (threadResult == (void*)ERROR) {
+      result = ERROR;
+    }
+  }
+
+  if (ready && pthread_barrier_destroy(&pool.barrier) != 0) {
+    fprintf(stderr, "Error: Failed to destroy barrier.\n");
+  }
+  if (pthread_mutex_destroy(&pool.startMutex) != 0) {
     fprintf(stderr, "Error: Failed to destroy mutex.\n");
+  }
+  if (pthread_cond_destroy(&pool.startCond) != 0) {
+    fprintf(stderr, "Error: Failed to destroy condition variable.\n");
+  }
+  // Whatever the threads left in their buffers goes out now
+  if (output_flush(&pool.output, SIZE_MAX, 1) != 0) {
+    result = ERROR;
+  }
+  if (output_failed(&pool.output)) {
+    fprintf(stderr, "Error: Output was lost, the rest of the file was not processed.\n");
+  }
+  output_destroy(&pool.output);
+  if (planned) {
+    free_shard_plan(&pool.plan);
+  }
+
+  if (pool.stats != NULL) {
+    for (int i = 1; i <= num_threads; i++)
+      stats_merge(&pool.stats[0], &pool.stats[i]);
+    if (stats_write(pathOut, &pool.stats[0]) != 0) {
+      result = ERROR;
+    }
+    free(pool.stats);
+  }
+
+  free(pool.tickets);
+  free(pool.progress);
+  free(pool.waitDelays);
+  free_command_stream(&stream);
+  release_state(state);
+
+  if (close(fdWrite) == ERROR) {
+    perror("Error closing output file.");
     return ERROR;
   }
 
-  ems_terminate();
-  return 0;
+  return result;
 }
 
-/* Function that executes the commands */
-void* thread_execute(void* args) {
-  ThreadParameters *parameters = (ThreadParameters*)args;
-  int fdRead = (parameters)->fdRead;
-  int fdWrite = (parameters)->fdWrite;
-  pthread_mutex_t * mutex = (parameters)->mutex;
-  size_t *xs = (parameters)->xs;
-  size_t *ys = (parameters)->ys;
-
-  while (1) {
-    unsigned int event_id;
-    size_t num_rows, num_columns, num_coords;
-
-    if (pthread_mutex_lock(mutex) != 0) {
-      fprintf(stderr, "Error: Failed to lock mutex.\n");
-      return (void*)ERROR;
+/* Function that serves the WAIT delays aimed at a thread */
+static void serve_wait(WorkerPool* pool, int thread_id) {
+  unsigned int delay = atomic_exchange(&pool->waitDelays[thread_id], 0);
+  if (delay == 0) {
+    return;
+  }
+
+  // WAITs that arrive while the thread sleeps push its wake up time further, before its next command
+  uint64_t waitStart = stats_clock();
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  do {
+    ems_deadline(&deadline, delay);
+    ems_wait_until(&deadline);
+    delay = atomic_exchange(&pool->waitDelays[thread_id], 0);
+  } while (delay > 0);
+  stats_command(CMD_WAIT, waitStart);
+}
+
+/* Function that applies a batch of RESERVEs on the same event */
+static void execute_reserve_batch(WorkerPool* pool, size_t* indices, size_t count) {
+  struct CommandStream *stream = pool->stream;
+  struct ReservationRequest requests[RESERVE_BATCH_MAX];
+
+  for (size_t r = 0; r < count; r++) {
+    struct JobCommand *command = &stream->commands[indices[r]];
+    requests[r] = (struct ReservationRequest){command->num_coords, stream->xs + command->coords,
+                                              stream->ys + command->coords, 0};
+  }
+
+  ems_reserve_batch(pool->state, stream->commands[indices[0]].event_id, requests, count);
+  for (size_t r = 0; r < count; r++) {
+    if (requests[r].result) {
+      fprintf(stderr, "Failed to reserve seats.\n");
     }
-    if (parameters->waitFlags[parameters->thread_id] == 1) {
-      if (pthread_mutex_unlock(mutex) != 0) {
-        fprintf(stderr, "Error: Failed to unlock mutex.\n");
-        return (void*)ERROR;
+  }
+}
+
+/* Function that runs commands of the stream and writes out early output once it piles up */
+static void run_commands(WorkerPool* pool, int thread_id, size_t* indices, size_t count) {
+  // Once output was lost the rest of the file is skipped, the threads still meet at every barrier
+  if (output_failed(&pool->output)) {
+    return;
+  }
+  pool->output.buffers[thread_id].seq = indices[0];
+
+  // WAITs are timed when they are served, dispatching one only hands it to its thread
+  struct JobCommand *command = &pool->stream->commands[indices[0]];
+  uint64_t commandStart = stats_clock();
+  if (count > 1) {
+    execute_reserve_batch(pool, indices, count);
+  } else {
+    execute_command(pool, thread_id, command);
+  }
+  if (command->type != CMD_WAIT) {
+    stats_commands(command->type, commandStart, count);
+  }
+
+  // A long segment writes out early whatever output is already in order
+  if (output_full(&pool->output.buffers[thread_id])) {
+    atomic_store(&pool->progress[thread_id], indices[count - 1] + 1);
+    output_flush(&pool->output, output_low_watermark(&pool->output), 0);
+  }
+}
+
+/* Function that ends a segment: every thread meets, the output is written and WAITs for all are served */
+static void end_segment(WorkerPool* pool, size_t end, unsigned int delay) {
+  int barrierResult = stats_barrier_wait(&pool->barrier);
+  if (barrierResult != 0 && barrierResult != PTHREAD_BARRIER_SERIAL_THREAD) {
+    fprintf(stderr, "Error: Failed to wait on barrier.\n");
+  }
+
+  // A WAIT without a thread delays every thread, counted from the moment they all met
+  uint64_t waitStart = stats_clock();
+  struct timespec deadline;
+  if (delay > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    ems_deadline(&deadline, delay);
+  }
+
+  // The whole segment has run, one thread writes its output while the others move on
+  if (barrierResult == PTHREAD_BARRIER_SERIAL_THREAD && output_flush(&pool->output, end, 1) != 0) {
+    fprintf(stderr, "Error: Failed to write output.\n");
+  }
+
+  if (delay > 0) {
+    ems_wait_until(&deadline);
+    stats_command(CMD_WAIT, waitStart);
+  }
+}
+
+/* Function that runs the segments of a job file, claiming commands in file order */
+static void execute_segments(WorkerPool* pool, int thread_id) {
+  struct CommandStream *stream = pool->stream;
+  atomic_size_t *progress = &pool->progress[thread_id];
+
+  for (size_t s = 0; s < stream->num_segments; s++) {
+    struct JobSegment *segment = &stream->segments[s];
+
+    while (1) {
+      // Every command this thread may still claim comes after the current ticket
+      atomic_store(progress, atomic_load(&pool->tickets[s]));
+
+      // A WAIT aimed at this thread is served before it claims another command
+      serve_wait(pool, thread_id);
+
+      // A run of RESERVEs on one event is claimed as a whole
+      size_t ticket = atomic_load(&pool->tickets[s]);
+      size_t count = 0;
+      while (ticket < segment->end) {
+        count = stream->commands[ticket].batch;
+        if (atomic_compare_exchange_weak(&pool->tickets[s], &ticket, ticket + count)) break;
       }
-      ems_wait(*parameters->delayWait);
-      if (pthread_mutex_lock(mutex) != 0) {
-        fprintf(stderr, "Error: Failed to lock mutex.\n");
-        return (void*)ERROR;
+      if (ticket >= segment->end) {
+        break;
       }
-      parameters->waitFlags[parameters->thread_id] = 0;
-    }
+      atomic_store(progress, ticket);
 
-    if (*parameters->barrierFlag) {
-      if (pthread_mutex_unlock(mutex) != 0) {
-        fprintf(stderr, "Error: Failed to unlock mutex.\n");
-        return (void*)ERROR;
+      size_t indices[RESERVE_BATCH_MAX];
+      for (size_t k = 0; k < count; k++) {
+        indices[k] = ticket + k;
       }
+      run_commands(pool, thread_id, indices, count);
+    }
 
-      return (void*)BARRIER;
+    if (s + 1 < stream->num_segments) {
+      end_segment(pool, segment->end, segment->delay);
     }
+  }
+}
 
-    // Read command
-    int command = (int)get_next(fdRead);
-    switch (command) {
-        case CMD_CREATE:
-          if (parse_create(fdRead, &event_id, &num_rows, &num_columns) != 0) {
-            fprintf(stderr, "Invalid command. See HELP for usage.\n");
-            continue;
-          }
-
-          if (pthread_mutex_unlock(mutex) != 0) {
-            fprintf(stderr, "Error: Failed to unlock mutex.\n");
-            return (void*)ERROR;
-          }
-
-          if (ems_create(event_id, num_rows, num_columns)) {
-            fprintf(stderr, "Failed to create event.\n");
-          }
-
-          break;
-
-        case CMD_RESERVE:
-          num_coords = parse_reserve(fdRead, MAX_RESERVATION_SIZE, &event_id, xs, ys);
-
-          if (pthread_mutex_unlock(mutex) != 0) {
-            fprintf(stderr, "Error: Failed to unlock mutex.\n");
-            return (void*)ERROR;
-          }
-
-          if (num_coords == 0) {
-            fprintf(stderr, "Invalid command. See HELP for usage.\n");
-            continue;
-          }
-
-          if (ems_reserve(event_id, num_coords, xs, ys)) {
-            fprintf(stderr, "Failed to reserve seats.\n");
-          }
-
-          break;
-
-        case CMD_SHOW:
-          if (parse_show(fdRead, &event_id) != 0) {
-            fprintf(stderr, "Invalid command. See HELP for usage.\n");
-            continue;
-          }
-
-          if (pthread_mutex_unlock(mutex) != 0) {
-            fprintf(stderr, "Error: Failed to unlock mutex.\n");
-            return (void*)ERROR;
-          }
-
-          if (ems_show(event_id, fdWrite)) {
-            fprintf(stderr, "Failed to show event.\n");
-          }
-
-          break;
-
-        case CMD_LIST_EVENTS:
-          if (pthread_mutex_unlock(mutex) != 0) {
-            fprintf(stderr, "Error: Failed to unlock mutex.\n");
-            return (void*)ERROR;
-          }
-
-          if (ems_list_events(fdWrite)) {
-            fprintf(stderr, "Failed to list events.\n");
-          }
-
-          break;
-
-        case CMD_WAIT:
-          if (parse_wait(fdRead, &(*parameters->delayWait), &(*parameters->waitingThread))) {
-            fprintf(stderr, "Invalid command. See HELP for usage.\n");
-            continue;
-          }
-
-          if (*parameters->delayWait > 0 && *parameters->waitingThread == 0) {
-            ems_wait(*parameters->delayWait);
-            if (pthread_mutex_unlock(mutex) != 0) {
-              fprintf(stderr, "Error: Failed to unlock mutex.\n");
-              return (void*)ERROR;
-            }
-            break;
-          }
-          else if ((int)*parameters->waitingThread <= global_num_threads) {
-            parameters->waitFlags[*parameters->waitingThread] = 1;
-          }
-          
-          if (pthread_mutex_unlock(mutex) != 0) {
-            fprintf(stderr, "Error: Failed to unlock mutex.\n");
-            return (void*)ERROR;
-          }
-
-          break;
-
-        case CMD_INVALID:
-          if (pthread_mutex_unlock(mutex) != 0) {
-            fprintf(stderr,"Error: Failed to unlock mutex.\n");
-            return (void*)ERROR;
-          }
-          fprintf(stderr, "Invalid command. See HELP for usage.\n");
-          break;
-
-        case CMD_HELP:
-          if (pthread_mutex_unlock(mutex) != 0) {
-            fprintf(stderr, "Error: Failed to unlock mutex.\n");
-            return (void*)ERROR;
-          }
-          printf(
-              "Available commands:\n"
-              "  CREATE <event_id> <num_rows> <num_columns>\n"
-              "  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
-              "  SHOW <event_id>\n"
-              "  LIST\n"
-              "  WAIT <delay_ms> [thread_id]\n"
-              "  BARRIER\n"
-              "  HELP\n");
-
-          break;
-
-        case CMD_BARRIER:
-          *parameters->barrierFlag = BARRIER;
-          if (pthread_mutex_unlock(mutex) != 0) {
-            fprintf(stderr, "Error: Failed to unlock mutex.\n");
-            return (void*)ERROR;
-          }
-          return (void*)BARRIER;
-        case CMD_EMPTY:
-          if (pthread_mutex_unlock(mutex) != 0) {
-            fprintf(stderr, "Error: Failed to unlock mutex.\n");
-            return (void*)ERROR;
-          }
-          break;
-
-        case EOC:
-          if (pthread_mutex_unlock(mutex) != 0) {
-            fprintf(stderr, "Error: Failed to unlock mutex.\n");
-            return (void*)ERROR;
-          }
-          return (void*)0;
+/* Function that runs the queue of a thread in every phase of a shard plan */
+static void execute_phases(WorkerPool* pool, int thread_id) {
+  struct ShardPlan *plan = &pool->plan;
+  atomic_size_t *progress = &pool->progress[thread_id];
+  size_t shard = (size_t)thread_id - 1;
+
+  for (size_t p = 0; p < plan->num_phases; p++) {
+    size_t *queue = plan->queue_starts + p * plan->num_shards + shard;
+
+    for (size_t q = queue[0]; q < queue[1];) {
+      atomic_store(progress, plan->order[q]);
+      serve_wait(pool, thread_id);
+
+      // RESERVEs on one event that follow each other in the queue are applied together
+      struct JobCommand *command = &pool->stream->commands[plan->order[q]];
+      size_t count = 1;
+      while (command->type == CMD_RESERVE && count < RESERVE_BATCH_MAX && q + count < queue[1]) {
+        struct JobCommand *next = &pool->stream->commands[plan->order[q + count]];
+        if (next->type != CMD_RESERVE || next->event_id != command->event_id) break;
+        count++;
       }
+
+      run_commands(pool, thread_id, plan->order + q, count);
+      q += count;
     }
+    atomic_store(progress, plan->phase_ends[p]);
+    serve_wait(pool, thread_id);
+
+    if (p + 1 < plan->num_phases) {
+      end_segment(pool, plan->phase_ends[p], plan->phase_delays[p]);
+    }
+  }
+}
+
+/* Function that runs the commands of a job file in one of the pool's threads */
+void* thread_execute(void* args) {
+  ThreadParameters *parameters = (ThreadParameters*)args;
+  WorkerPool *pool = (parameters)->pool;
+  int thread_id = parameters->thread_id;
+
+  if (pthread_mutex_lock(&pool->startMutex) != 0) {
+    fprintf(stderr, "Error: Failed to lock mutex.\n");
+    return (void*)ERROR;
   }
+  while (pool->started == 0)
+    pthread_cond_wait(&pool->startCond, &pool->startMutex);
+  int started = pool->started;
+  if (pthread_mutex_unlock(&pool->startMutex) != 0) {
+    fprintf(stderr, "Error: Failed to unlock mutex.\n");
+    return (void*)ERROR;
+  }
+  if (started < 0) {
+    return (void*)ERROR;
+  }
+  stats_attach(pool->stats != NULL ? &pool->stats[thread_id] : NULL);
+  affinity_pin_thread(thread_id - 1);
+
+  // With -e every event belongs to one thread, otherwise threads take the next command in file order
+  if (pool->sharded) {
+    execute_phases(pool, thread_id);
+  } else {
+    execute_segments(pool, thread_id);
+  }
+
+  stats_attach(NULL);
+  freeSortScratch();
+  ems_free_snapshot();
+  return (void*)0;
+}
+
+/* Function that executes one command */
+void execute_command(WorkerPool* pool, int thread_id, struct JobCommand* command) {
+  struct EMSState *state = pool->state;
+  struct CommandStream *stream = pool->stream;
+  struct OutputBuffer *out = &pool->output.buffers[thread_id];
+
+  switch (command->type) {
+    case CMD_CREATE:
+      if (ems_create(state, command->event_id, command->num_rows, command->num_cols,
+                     (size_t)(command - stream->commands))) {
+        fprintf(stderr, "Failed to create event.\n");
+      }
+
+      break;
+
+    case CMD_RESERVE:
+      if (ems_reserve(state, command->event_id, command->num_coords, stream->xs + command->coords,
+                      stream->ys + command->coords)) {
+        fprintf(stderr, "Failed to reserve seats.\n");
+      }
+
+      break;
+
+    case CMD_SHOW:
+      if (ems_show(state, command->event_id, out)) {
+        fprintf(stderr, "Failed to show event.\n");
+      }
+
+      break;
+
+    case CMD_LIST_EVENTS:
+      if (ems_list_events(state, out)) {
+        fprintf(stderr, "Failed to list events.\n");
+      }
+
+      break;
+
+    case CMD_WAIT:
+      // WAITs for every thread end a segment, only targeted ones are dispatched
+      if (command->thread_id > 0 && (int)command->thread_id <= pool->num_threads) {
+        atomic_fetch_add(&pool->waitDelays[command->thread_id], command->delay);
+      }
+
+      break;
+
+    case CMD_INVALID:
+      fprintf(stderr, "Invalid command. See HELP for usage.\n");
+      break;
+
+    case CMD_HELP:
+      printf(
+          "Available commands:\n"
+          "  CREATE <event_id> <num_rows> <num_columns>\n"
+          "  RESERVE <event_id> [(<x1>,<y1>) (<x2>,<y2>) ...]\n"
+          "  SHOW <event_id>\n"
+          "  LIST\n"
+          "  WAIT <delay_ms> [thread_id]\n"
+          "  BARRIER\n"
+          "  HELP\n");
+
+      break;
+
+    case CMD_BARRIER:
+    case CMD_EMPTY:
+    case EOC:
+      // Segment boundaries and blank lines are never dispatched
+      break;
+  }
+}
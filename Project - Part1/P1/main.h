@@ -2,28 +2,54 @@
 #define EMS_MAIN_H
 
 #include "constants.h"
+#include "commands.h"
+#include "operations.h"
+#include "output.h"
+#include "shared.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <pthread.h>
 #include <dirent.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
 
-#define BARRIER 1
+// Threads that run every segment of one job file
+typedef struct {
+  struct EMSState *state;
+  struct OrderedOutput output;  // Output buffer of each thread, written in command order
+  int num_threads;
+  struct CommandStream *stream;
+  int sharded;                  // Whether commands are run by the thread that owns their event
+  struct ShardPlan plan;        // Queue of each thread when sharded
+  atomic_size_t *tickets;       // Next command to be claimed in each segment
+  atomic_size_t *progress;      // No command of a thread before this one is still running
+  atomic_uint *waitDelays;      // Pending targeted WAIT delay of each thread
+  struct ThreadStats *stats;    // Counters of each thread, NULL when statistics are off
+  pthread_barrier_t barrier;    // Rendezvous at the end of each segment
+
+  pthread_mutex_t startMutex;   // Holds the threads until the pool is complete
+  pthread_cond_t startCond;
+  int started;
+} WorkerPool;
 
 typedef struct {
-  int fdRead;
-  int fdWrite;
-  int *barrierFlag;
-  unsigned int *delayWait;
-  unsigned int *waitingThread;
   int thread_id;
-  int *waitFlags;
-  pthread_mutex_t *mutex;
-  size_t *xs; 
-  size_t *ys;
+  WorkerPool *pool;
 } ThreadParameters;
 
+// A child process running one job file
+typedef struct {
+  pid_t pid;          // 0 when the slot is free
+  size_t size;        // Size of the job file
+  int num_threads;    // Threads the child runs the file with
+  uint64_t start_ns;  // When the child was forked
+} ChildSlot;
+
 int iterateFiles(char* directoryPath);
-int process_file(char* pathJobs, char* pathOut);
+int process_file(char* pathJobs, char* pathOut, int num_threads);
 void* thread_execute(void* args);
+void execute_command(WorkerPool* pool, int thread_id, struct JobCommand* command);
 
 #endif
\ No newline at end of file
@@ -1,22 +1,33 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdatomic.h>
 
 #include "eventlist.h"
+#include "operations.h"
 #include "auxFunctions.h"
 #include "main.h"
+#include "output.h"
+#include "stats.h"
 
 
 
-#define BUFFERSIZE 1024
-#define IDMAX 128
+#define LIST_CHUNK_EVENTS 4096   // Events formatted per output reservation
+#define LIST_LINE_MAX_CHARS 18   // "Event: ", the digits of an unsigned int and a newline
+#define SHOW_CHUNK_SIZE 65536  // Output reserved at a time by SHOW
+#define SEAT_MAX_CHARS 11      // Digits of an unsigned int plus a separator
+#define SHOW_OPTIMISTIC_TRIES 4  // Lock free copies SHOW attempts before locking out the reservations
+#define CLAIM_SPINS 16  // Yields on a tentatively claimed seat before sleeping until it is resolved
+#define SHOW_SNAPSHOT_MAX_SEATS ((size_t)1 << 20)  // Largest event SHOW copies whole, so a snapshot stays within 4 MiB
+#define SHOW_RANGE_SEATS (SHOW_CHUNK_SIZE / SEAT_MAX_CHARS)  // Seats copied at a time for larger events
 
-static struct EventList* event_list = NULL;
-static unsigned int state_access_delay_ms = 0;
-pthread_mutex_t global_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_rwlock_t global_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+/// Copy of the seats being shown by the calling thread, reused by every SHOW it runs; at most
+/// SHOW_SNAPSHOT_MAX_SEATS seats.
+static _Thread_local unsigned int* showSnapshot = NULL;
+static _Thread_local size_t showCapacity = 0;
 
 /// Calculates a timespec from a delay in milliseconds.
 /// @param delay_ms Delay in milliseconds.
@@ -27,25 +38,134 @@ static struct timespec delay_to_timespec(unsigned int delay_ms) {
 
 /// Gets the event with the given ID from the state.
 /// @note Will wait to simulate a real system accessing a costly memory resource.
+/// @param state The state to get the event from.
 /// @param event_id The ID of the event to get.
 /// @return Pointer to the event if found, NULL otherwise.
-static struct Event* get_event_with_delay(unsigned int event_id) {
-  struct timespec delay = delay_to_timespec(state_access_delay_ms);
-  nanosleep(&delay, NULL);  // Should not be removed
+static struct Event* get_event_with_delay(struct EMSState* state, unsigned int event_id) {
+  if (state->delay_ms > 0) {
+    struct timespec delay = delay_to_timespec(state->delay_ms);
+    nanosleep(&delay, NULL);  // Should not be removed
+  }
 
-  return get_event(event_list, event_id);
+  return get_event(state->event_list, event_id);
 }
 
 /// Gets the seat with the given index from the state.
 /// @note Will wait to simulate a real system accessing a costly memory resource.
+/// @param state The state the event belongs to.
 /// @param event Event to get the seat from.
 /// @param index Index of the seat to get.
-/// @return Pointer to the seat.
-static unsigned int* get_seat_with_delay(struct Event* event, size_t index) {
-  struct timespec delay = delay_to_timespec(state_access_delay_ms);
-  nanosleep(&delay, NULL);  // Should not be removed
+/// @return Pointer to the seat, NULL if the page of a sparse event could not be allocated.
+static atomic_uint* get_seat_with_delay(struct EMSState* state, struct Event* event, size_t index) {
+  if (state->delay_ms > 0) {
+    struct timespec delay = delay_to_timespec(state->delay_ms);
+    nanosleep(&delay, NULL);  // Should not be removed
+  }
+
+  return seat_slot(state->arena, event, index);
+}
+
+/// Reads the seat with the given index from the state.
+/// @note Will wait to simulate a real system accessing a costly memory resource.
+/// @param state The state the event belongs to.
+/// @param event Event to read the seat from.
+/// @param index Index of the seat to read.
+/// @return Id of the reservation holding the seat, 0 if it is free.
+static unsigned int read_seat_with_delay(struct EMSState* state, struct Event* event, size_t index) {
+  if (state->delay_ms > 0) {
+    struct timespec delay = delay_to_timespec(state->delay_ms);
+    nanosleep(&delay, NULL);  // Should not be removed
+  }
 
-  return &event->data[index];
+  return seat_load(event, index);
+}
+
+/// Locks an event for reading (RESERVE batches) or writing (SHOW fallbacks), unless the calling thread owns it.
+/// @return 0 if the event was locked successfully, an error number otherwise.
+static int lock_event(struct EMSState* state, struct Event* event, int write) {
+  if (state->owned_events) return 0;
+  return write ? stats_wrlock(&event->rwlock, STATS_LOCK_SHOW) : stats_rdlock(&event->rwlock, STATS_LOCK_RESERVE);
+}
+
+/// Unlocks an event locked with lock_event.
+static int unlock_event(struct EMSState* state, struct Event* event) {
+  if (state->owned_events) return 0;
+  return pthread_rwlock_unlock(&event->rwlock);
+}
+
+/// Copies a range of seats of an event into the snapshot of the calling thread.
+/// @note Nothing stops reservations from changing the seats meanwhile, the caller validates the copy.
+/// @param first Index of the first seat to copy.
+/// @param num_seats Number of seats to copy.
+/// @param seq Sequence lock value the copy started at, NULL when the event is locked. A delayed copy stops
+///            as soon as it changes, since the caller will throw the copy away anyway.
+/// @return 0 if the seats were copied, 1 if the snapshot could not be allocated.
+static int copy_seats(struct EMSState* state, struct Event* event, size_t first, size_t num_seats,
+                      const uint64_t* seq) {
+  if (num_seats > showCapacity) {
+    unsigned int* snapshot = realloc(showSnapshot, num_seats * sizeof(unsigned int));
+    if (snapshot == NULL) {
+      fprintf(stderr, "Error allocating memory for seats.\n");
+      return 1;
+    }
+    showSnapshot = snapshot;
+    showCapacity = num_seats;
+  }
+
+  if (event->data != NULL && state->delay_ms == 0) {
+    for (size_t i = 0; i < num_seats; i++) {
+      showSnapshot[i] = atomic_load_explicit(&event->data[first + i], memory_order_relaxed);
+    }
+    return 0;
+  }
+
+  for (size_t i = 0; i < num_seats; i++) {
+    showSnapshot[i] = read_seat_with_delay(state, event, first + i);
+    if (seq != NULL && atomic_load_explicit(&event->seq, memory_order_relaxed) != *seq) break;
+  }
+  return 0;
+}
+
+/// Takes a consistent copy of a range of seats of an event without excluding the reservations, like a
+/// seqlock reader: the copy only counts if no RESERVE batch ran while it was taken. After
+/// SHOW_OPTIMISTIC_TRIES failed tries the event is locked for writing just for the copy, so a SHOW always
+/// finishes under a steady stream of RESERVEs.
+/// @return 0 if the seats were copied, 1 otherwise.
+static int snapshot_seats(struct EMSState* state, struct Event* event, size_t first, size_t num_seats) {
+  // Each try sleeps once per seat when accesses are delayed, so those get a single one
+  size_t tries = state->delay_ms > 0 ? 1 : SHOW_OPTIMISTIC_TRIES;
+  for (size_t try = 0; try < tries; try++) {
+    uint64_t before = atomic_load_explicit(&event->seq, memory_order_acquire);
+    if ((before & EVENT_SEQ_WRITERS) == 0) {
+      if (copy_seats(state, event, first, num_seats, &before) != 0) {
+        return 1;
+      }
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&event->seq, memory_order_relaxed) == before) {
+        return 0;
+      }
+    }
+    stats_show_retry();
+    sched_yield();
+  }
+
+  // Reservations hold the event lock for reading, so they are all done once it is held for writing
+  if (lock_event(state, event, 1) != 0) {
+    fprintf(stderr, "Error locking write event lock.\n");
+    return 1;
+  }
+  int result = copy_seats(state, event, first, num_seats, NULL);
+  if (unlock_event(state, event) != 0) {
+    fprintf(stderr, "Error unlocking write event lock.\n");
+    result = 1;
+  }
+  return result;
+}
+
+void ems_free_snapshot(void) {
+  free(showSnapshot);
+  showSnapshot = NULL;
+  showCapacity = 0;
 }
 
 /// Gets the index of a seat.
@@ -56,51 +176,101 @@ static unsigned int* get_seat_with_delay(struct Event* event, size_t index) {
 /// @return Index of the seat.
 static size_t seat_index(struct Event* event, size_t row, size_t col) { return (row - 1) * event->cols + col - 1; }
 
-int ems_init(unsigned int delay_ms) {
-  if (event_list != NULL) {
-    fprintf(stderr, "EMS state has already been initialized\n");
+/// Initializes a state whose events live in the given arena, or on the heap when it is NULL.
+static int init_state(struct EMSState* state, unsigned int delay_ms, struct SharedArena* arena) {
+  state->arena = arena;
+  state->owned_events = 0;
+  state->event_list = create_list(arena);
+  state->delay_ms = delay_ms;
+  if (state->event_list == NULL) {
     return 1;
   }
 
-  event_list = create_list();
-  state_access_delay_ms = delay_ms;
+  if (arena_rwlock_init(arena, &state->rwlock) != 0) {
+    free_list(state->event_list);
+    state->event_list = NULL;
+    return 1;
+  }
+
+  atomic_init(&state->claim_waiters, 0);
+  if (arena_cond_init(arena, &state->claim_mutex, &state->claim_cond) != 0) {
+    pthread_rwlock_destroy(&state->rwlock);
+    free_list(state->event_list);
+    state->event_list = NULL;
+    return 1;
+  }
+
+  return 0;
+}
+
+int ems_init(struct EMSState* state, unsigned int delay_ms) { return init_state(state, delay_ms, NULL); }
+
+struct EMSState* ems_init_shared(unsigned int delay_ms, size_t size) {
+  struct SharedArena* arena = arena_create(size);
+  if (arena == NULL) {
+    return NULL;
+  }
+
+  // The state itself is shared too, so every process takes the same locks
+  struct EMSState* state = arena_alloc(arena, sizeof(struct EMSState));
+  if (state == NULL || init_state(state, delay_ms, arena) != 0) {
+    arena_destroy(arena);
+    return NULL;
+  }
 
-  return event_list == NULL;
+  return state;
 }
 
-int ems_terminate() {
-  if (event_list == NULL) {
+int ems_terminate(struct EMSState* state) {
+  if (state->event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  free_list(event_list);
-  return 0;
+  struct SharedArena* arena = state->arena;
+  free_list(state->event_list);
+  state->event_list = NULL;
+  int result = 0;
+  if (pthread_rwlock_destroy(&state->rwlock) != 0) {
+    fprintf(stderr, "Error destroying read-write lock.\n");
+    result = 1;
+  }
+  if (pthread_cond_destroy(&state->claim_cond) != 0 || pthread_mutex_destroy(&state->claim_mutex) != 0) {
+    fprintf(stderr, "Error destroying the seat claim condition.\n");
+    result = 1;
+  }
+
+  // A shared state lives in its own arena
+  if (arena != NULL) {
+    arena_destroy(arena);
+  }
+  return result;
 }
 
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
-  if (event_list == NULL) {
+int ems_create(struct EMSState* state, unsigned int event_id, size_t num_rows, size_t num_cols, size_t order) {
+  if (state->event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized\n");
     return 1;
   }
 
-  if (pthread_rwlock_wrlock(&global_rwlock) != 0) {
+  if (stats_wrlock(&state->rwlock, STATS_LOCK_CREATE) != 0) {
     fprintf(stderr, "Error locking write lock\n.");
     return 1;
   }
   
-  if (get_event_with_delay(event_id) != NULL) {
+  if (get_event_with_delay(state, event_id) != NULL) {
     fprintf(stderr, "Event already exists\n");
-    if(pthread_rwlock_unlock(&global_rwlock) != 0) {
+    if(pthread_rwlock_unlock(&state->rwlock) != 0) {
       fprintf(stderr, "Error unloking write lock.\n");
     }
     return 1;
   }
 
-  struct Event* event = malloc(sizeof(struct Event));
+  // Header, reservation counter and seats come in one zeroed block
+  struct Event* event = alloc_event(state->arena, num_rows, num_cols);
   if (event == NULL) {
     fprintf(stderr, "Error allocating memory for event.\n");
-    if (pthread_rwlock_unlock(&global_rwlock) != 0) {
+    if (pthread_rwlock_unlock(&state->rwlock) != 0) {
       fprintf(stderr, "Error unlocking write lock.\n");
       return 1;
     }
@@ -108,66 +278,27 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
   }
 
   event->id = event_id;
-  event->rows = num_rows;
-  event->cols = num_cols;
-  event->reservations = 0;
-  if (pthread_mutex_init(&event->mutex, NULL) != 0) {
-    fprintf(stderr, "Error initializing event mutex\n");
-    return 1;
-  }
-  if (pthread_rwlock_init(&event->rwlock, NULL) != 0) {
+  if (arena_rwlock_init(state->arena, &event->rwlock) != 0) {
     fprintf(stderr, "Error initializing event read-write lock\n");
-    return 1;
-  }
-  event->data = malloc(num_rows * num_cols * sizeof(unsigned int));
-  if (event->data == NULL) {
-    fprintf(stderr, "Error allocating memory for event data\n");
-    free(event);
-    if (pthread_rwlock_unlock(&global_rwlock) != 0)
+    release_event(state->arena, event);
+    if (pthread_rwlock_unlock(&state->rwlock) != 0)
       fprintf(stderr, "Error unlocking write lock.\n");
     return 1;
   }
 
-  event->seatsLock = malloc(event->rows * event->cols * sizeof(pthread_mutex_t));
-  if (event->seatsLock == NULL) {
-    fprintf(stderr, "Error allocating memory for seatsLock");
-    return 1;
-  }
-
-  int num_seats = (int)(num_rows * num_cols);
-  for (int i = 0; i < num_seats; i++){
-    if (pthread_mutex_init(&event->seatsLock[i], NULL) != 0) {
-      fprintf(stderr, "Error initializing mutex");
-      return 1;
-    }
-  }
-
-  for (size_t i = 0; i < num_rows * num_cols; i++) {
-    event->data[i] = 0;
-  }
-
-  if (append_to_list(event_list, event) != 0) {
+  // Events are listed in the order of their CREATEs, even when threads get to them out of order;
+  // processes sharing a state have no common order and list them as they come
+  if (append_to_list(state->event_list, event, state->arena != NULL ? SIZE_MAX : order) != 0) {
     fprintf(stderr, "Error appending event to list\n");
-    free(event->data);
 
-    for (int i = 0; i < num_seats; i++){
-      if (pthread_mutex_destroy(&event->seatsLock[i]) != 0) {
-        fprintf(stderr, "Error destroying mutex");
-        return 1;
-      }
-    }
-    free(event->seatsLock);
-
-    if (pthread_rwlock_unlock(&global_rwlock) != 0)
+    if (pthread_rwlock_unlock(&state->rwlock) != 0)
       fprintf(stderr, "Error unlocking write lock.\n");
     if (pthread_rwlock_destroy(&event->rwlock) != 0)
         fprintf(stderr, "Error destroying event read-write lock\n");
-    if (pthread_mutex_destroy(&event->mutex) != 0)
-      fprintf(stderr, "Error destroying event mutex\n");
-    free(event);
+    release_event(state->arena, event);
     return 1;
   }
-  if (pthread_rwlock_unlock(&global_rwlock) != 0) {
+  if (pthread_rwlock_unlock(&state->rwlock) != 0) {
     fprintf(stderr, "Error unlocking write lock.\n");
     return 1;
   }
@@ -175,247 +306,281 @@ int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols) {
   return 0;
 }
 
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
-  if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized.\n");
-    return 1;
+/// Sleeps until a seat is no longer held by the given tentative claim.
+static void wait_for_claim(struct EMSState* state, atomic_uint* seat, unsigned int holder) {
+  // The holder checks for waiters after resolving its seats, so either it sees this one or this one sees the seat
+  atomic_fetch_add(&state->claim_waiters, 1);
+  pthread_mutex_lock(&state->claim_mutex);
+  while (atomic_load(seat) == holder) {
+    pthread_cond_wait(&state->claim_cond, &state->claim_mutex);
   }
+  pthread_mutex_unlock(&state->claim_mutex);
+  atomic_fetch_sub(&state->claim_waiters, 1);
+}
 
-  if (pthread_rwlock_rdlock(&global_rwlock) != 0) {
-    fprintf(stderr, "Error locking read lock.\n");
-    return 1;
-  }
-  struct Event* event = get_event_with_delay(event_id);
-  if (pthread_rwlock_unlock(&global_rwlock) != 0) {
-    fprintf(stderr, "Error unlocking read lock.\n");
-    return 1;
-  }
+/// Wakes the reservations sleeping on tentative claims, once a reservation has resolved all of its own.
+static void release_claims(struct EMSState* state) {
+  if (atomic_load(&state->claim_waiters) == 0) return;
 
-  if (event == NULL) {
-    fprintf(stderr, "Event not found.\n");
-    return 1;
+  pthread_mutex_lock(&state->claim_mutex);
+  pthread_cond_broadcast(&state->claim_cond);
+  pthread_mutex_unlock(&state->claim_mutex);
+}
+
+/// Claims a free seat for a reservation, marked as tentative until the reservation has all its seats.
+/// @note A seat tentatively held by another reservation is waited on rather than treated as taken, since
+///       that reservation may still fail and give it back. Seats are claimed in sorted order, so the
+///       reservation being waited on never waits on this one. The holder may sleep on the state access
+///       delay meanwhile, so after a few yields the wait sleeps too.
+/// @return 0 if the seat was claimed, 1 if another reservation holds it for good.
+static int claim_seat(struct EMSState* state, atomic_uint* seat, unsigned int newId) {
+  uint64_t waitStart = 0;
+  for (size_t spins = 0;; spins++) {
+    unsigned int expected = 0;
+    if (atomic_compare_exchange_strong(seat, &expected, newId | SEAT_TENTATIVE) || !(expected & SEAT_TENTATIVE)) {
+      if (spins > 0) stats_lock_wait(STATS_LOCK_CLAIM, waitStart);
+      return expected != 0;
+    }
+
+    if (spins == 0) {
+      waitStart = stats_clock();
+    }
+    if (spins < CLAIM_SPINS) {
+      sched_yield();
+    } else {
+      wait_for_claim(state, seat, expected);
+    }
   }
+}
 
+/// Applies one reservation to an event the caller has already locked.
+/// @note The reservation either takes every seat or none, and always consumes an id once its
+///       seats are sorted.
+/// @return 0 if the reservation was created successfully, 1 otherwise.
+static int reserve_locked(struct EMSState* state, struct Event* event, size_t num_seats, size_t* xs, size_t* ys) {
   if (sortVectors(num_seats, xs, ys)) {
     fprintf(stderr, "Invalid Seats to Sort\n");
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&event->rwlock) != 0) {
-    fprintf(stderr, "Error locking read lock.\n");
-    return 1;
-  }
-
-  unsigned int myValue = atomic_load(&event->reservations);
-  unsigned int newId = myValue + 1;
-  atomic_store(&event->reservations, newId);
+  // Failed reservations still consume their id
+  unsigned int newId = atomic_fetch_add(&event->reservations, 1) + 1;
   size_t i = 0;
   for (; i < num_seats; i++) {
     size_t row = xs[i];
     size_t col = ys[i];
 
-
     if (row <= 0 || row > event->rows || col <= 0 || col > event->cols) {
       fprintf(stderr, "Invalid seat\n");
       break;
     }
 
-    if(pthread_mutex_lock(&event->seatsLock[seat_index(event, row, col)]) != 0) {
-      fprintf(stderr, "Error locking mutex seat lock.\n");
-      return 1;
+    atomic_uint* seat = get_seat_with_delay(state, event, seat_index(event, row, col));
+    if (seat == NULL) {
+      fprintf(stderr, "Error allocating memory for seats.\n");
+      break;
     }
 
-    if (*get_seat_with_delay(event, seat_index(event, row, col)) != 0) {
+    if (claim_seat(state, seat, newId) != 0) {
       fprintf(stderr, "Seat already reserved\n");
-      if(pthread_mutex_unlock(&event->seatsLock[seat_index(event, row, col)]) != 0) {
-        fprintf(stderr, "Error unlocking mutex seat lock\n.");
-        return 1;
-      }
+      stats_seat_conflict();
       break;
     }
-
-    *get_seat_with_delay(event, seat_index(event, row, col)) = newId;
   }
-  
+
   // If the reservation was not successful, free the seats that were reserved.
   if (i < num_seats) {
-    //event->reservations--;
     for (size_t j = 0; j < i; j++) {
-      *get_seat_with_delay(event, seat_index(event, xs[j], ys[j])) = 0;
-      if(pthread_mutex_unlock(&event->seatsLock[seat_index(event, xs[j], ys[j])]) != 0) {
-        fprintf(stderr, "Error unlocking mutex seat lock\n.");
-        return 1;
-      }
-    }
-    if (pthread_rwlock_unlock(&event->rwlock) != 0) {
-      fprintf(stderr, "Error unlocking write lock.\n");
-      return 1;
+      unsigned int expected = newId | SEAT_TENTATIVE;
+      atomic_compare_exchange_strong(get_seat_with_delay(state, event, seat_index(event, xs[j], ys[j])), &expected, 0);
     }
+    if (i > 0) release_claims(state);
     return 1;
   }
+
+  // Every seat is held, commit them; their pages exist already, so this is not a state access
   for (size_t j = 0; j < num_seats; j++) {
-    if(pthread_mutex_unlock(&event->seatsLock[seat_index(event, xs[j], ys[j])]) != 0) {
-      fprintf(stderr, "Error unlocking mutex seat lock\n.");
-      return 1;
-    }
-  }
-  if (pthread_rwlock_unlock(&event->rwlock) != 0) {
-    fprintf(stderr, "Error unlocking write lock.\n");
-    return 1;
+    atomic_store(seat_slot(state->arena, event, seat_index(event, xs[j], ys[j])), newId);
   }
+  release_claims(state);
+
   return 0;
 }
 
-int ems_show(unsigned int event_id, int fdWrite) {
-  if (event_list == NULL) {
-    fprintf(stderr, "EMS state must be initialized.\n");
-    return 1;
-  }
+int ems_reserve(struct EMSState* state, unsigned int event_id, size_t num_seats, size_t* xs, size_t* ys) {
+  struct ReservationRequest request = {num_seats, xs, ys, 0};
+  ems_reserve_batch(state, event_id, &request, 1);
+  return request.result;
+}
 
-  if (pthread_rwlock_rdlock(&global_rwlock) != 0) {
-    fprintf(stderr, "Error locking read lock.\n");
-    return 1;
+int ems_reserve_batch(struct EMSState* state, unsigned int event_id, struct ReservationRequest* requests,
+                      size_t count) {
+  for (size_t r = 0; r < count; r++) {
+    requests[r].result = 1;
   }
-  struct Event* event = get_event_with_delay(event_id);
-  if (pthread_rwlock_unlock(&global_rwlock) != 0) {
-    fprintf(stderr, "Error unlocking read lock.\n");
+
+  if (state->event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized.\n");
     return 1;
   }
 
+  // The event is looked up and locked once for the whole batch; lookups take no state lock
+  struct Event* event = get_event_with_delay(state, event_id);
+
   if (event == NULL) {
-    fprintf(stderr, "Event not found.\n");
+    for (size_t r = 0; r < count; r++) {
+      fprintf(stderr, "Event not found.\n");
+    }
     return 1;
   }
 
-  char *buffer = malloc(((event->rows * event->cols) * sizeof(char)) * 2 + 2);
-  if (buffer == NULL) {
-    fprintf(stderr, "Error allocating memory for buffer.\n");
+  if (lock_event(state, event, 0) != 0) {
+    fprintf(stderr, "Error locking read lock.\n");
     return 1;
   }
-  char *current = buffer;  // Auxiliar pointer to the current position in the buffer
 
-  if(pthread_rwlock_wrlock(&event->rwlock) != 0) {
-    fprintf(stderr, "Error locking write event lock.\n");
+  // Open the batch on the sequence lock before claiming any seat, see snapshot_seats
+  atomic_fetch_add_explicit(&event->seq, EVENT_SEQ_WRITER, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  int result = 0;
+  for (size_t r = 0; r < count; r++) {
+    requests[r].result = reserve_locked(state, event, requests[r].num_seats, requests[r].xs, requests[r].ys);
+    result |= requests[r].result;
+  }
+
+  // Close the batch and start a new generation in one step
+  atomic_fetch_add_explicit(&event->seq, EVENT_SEQ_GENERATION - EVENT_SEQ_WRITER, memory_order_release);
+
+  if (unlock_event(state, event) != 0) {
+    fprintf(stderr, "Error unlocking read lock.\n");
     return 1;
   }
-  for (size_t i = 1; i <= event->rows; i++) {
-    for (size_t j = 1; j <= event->cols; j++) {
-      unsigned int* seat = get_seat_with_delay(event, seat_index(event, i, j));
-      int written = snprintf(current, 2, "%u", *seat);
-      current += written;
+  return result;
+}
 
-      if (j < event->cols) {
-          int space_written = snprintf(current, 2, " ");
-          current += space_written;
+/// Renders a copy of the seats of an event into the output, a bounded chunk of rows at a time.
+/// @return 0 if the seats were rendered successfully, 1 otherwise.
+static int render_seats(struct Event* event, const unsigned int* seats, struct OutputBuffer* out) {
+  // Rows are rendered in batches of about SHOW_CHUNK_SIZE bytes straight into the output buffer
+  size_t row_bound = event->cols * SEAT_MAX_CHARS + 1;
+  size_t rows_per_chunk = row_bound < SHOW_CHUNK_SIZE ? SHOW_CHUNK_SIZE / row_bound : 1;
+
+  int result = 0;
+  size_t index = 0;
+  for (size_t first = 1; first <= event->rows; first += rows_per_chunk) {
+    size_t last = event->rows - first < rows_per_chunk ? event->rows : first + rows_per_chunk - 1;
+    char *current = output_begin(out, (last - first + 1) * row_bound);
+    if (current == NULL) {
+      result = 1;
+      break;
+    }
+
+    for (size_t i = first; i <= last; i++) {
+      for (size_t j = 1; j <= event->cols; j++) {
+        current = writeUint(current, seats[index]);
+        index++;
+        *current++ = j < event->cols ? ' ' : '\n';
       }
+      if (event->cols == 0) {
+        *current++ = '\n';
+      }
+    }
+    if (output_end(out, current) != 0) {
+      result = 1;
+      break;
     }
-    int newline_written = snprintf(current, 2, "\n");
-    current += newline_written;
   }
 
-  *current = '\n';
-  current++;
-  *current = '\0';
-  if (pthread_rwlock_unlock(&event->rwlock) != 0) {
-    fprintf(stderr, "Error unlocking read lock.\n");
-    return 1;
-  }
-  if (pthread_mutex_lock(&global_mutex) != 0) {
-    fprintf(stderr, "Error locking global mutex.\n");
-    return 1;
+  if (result == 0) {
+    result = output_write(out, "\n", 1);
   }
+  return result;
+}
 
-  writeFile(fdWrite, buffer);
+/// Renders the seats of an event too large to copy whole, copying and rendering SHOW_RANGE_SEATS at a time.
+/// @note Each range is a consistent copy of its seats, but a reservation made between two ranges shows in
+///       the later one only. Pages of a sparse event that were never allocated render as zeros.
+/// @return 0 if the seats were rendered successfully, 1 otherwise.
+static int render_seat_ranges(struct EMSState* state, struct Event* event, struct OutputBuffer* out) {
+  size_t num_seats = event->rows * event->cols;
 
-  if (pthread_mutex_unlock(&global_mutex) != 0) {
-    fprintf(stderr, "Error unlocking global mutex.\n");
-    return 1;
+  for (size_t first = 0; first < num_seats; first += SHOW_RANGE_SEATS) {
+    size_t count = num_seats - first < SHOW_RANGE_SEATS ? num_seats - first : SHOW_RANGE_SEATS;
+    if (snapshot_seats(state, event, first, count) != 0) {
+      return 1;
+    }
+
+    char *current = output_begin(out, count * SEAT_MAX_CHARS);
+    if (current == NULL) {
+      return 1;
+    }
+    for (size_t k = 0; k < count; k++) {
+      current = writeUint(current, showSnapshot[k]);
+      *current++ = (first + k + 1) % event->cols != 0 ? ' ' : '\n';
+    }
+    if (output_end(out, current) != 0) {
+      return 1;
+    }
   }
-  free(buffer);
-  return 0;
-}
 
+  return output_write(out, "\n", 1);
+}
 
-int ems_list_events(int fdWrite) {
-  if (event_list == NULL) {
+int ems_show(struct EMSState* state, unsigned int event_id, struct OutputBuffer* out) {
+  if (state->event_list == NULL) {
     fprintf(stderr, "EMS state must be initialized.\n");
     return 1;
   }
 
-  if (pthread_rwlock_rdlock(&global_rwlock) != 0) {
-    fprintf(stderr, "Error locking read lock.\n");
+  struct Event* event = get_event_with_delay(state, event_id);
+
+  if (event == NULL) {
+    fprintf(stderr, "Event not found.\n");
     return 1;
   }
 
-  if (event_list->head == NULL) {
-    if (pthread_rwlock_unlock(&global_rwlock) != 0) {
-        fprintf(stderr, "Error unlocking read lock.\n");
-        return 1;
-    }
-    if (pthread_mutex_lock(&global_mutex) != 0) {
-        fprintf(stderr, "Error locking global mutex.\n");
-        return 1;
-    }
-
-    writeFile(fdWrite, "No events\n");
-
-    if (pthread_mutex_unlock(&global_mutex) != 0) {
-        fprintf(stderr, "Error unlocking global mutex.\n");
-        return 1;
-    }
-
-    return 0;
+  // Reservations keep going while the seats are copied, only the copy is rendered
+  size_t num_seats = event->rows * event->cols;
+  if (num_seats > SHOW_SNAPSHOT_MAX_SEATS) {
+    return render_seat_ranges(state, event, out);
   }
-
-  struct ListNode* current = event_list->head;
-  if (pthread_rwlock_unlock(&global_rwlock) != 0) {
-    fprintf(stderr, "Error unlocking read lock.\n");
+  if (snapshot_seats(state, event, 0, num_seats) != 0) {
     return 1;
   }
+  return render_seats(event, showSnapshot, out);
+}
 
-  char *buffer = malloc(sizeof(char) * BUFFERSIZE);
-  if (buffer == NULL) {
-    fprintf(stderr, "Error allocating memory for buffer.\n");
+int ems_list_events(struct EMSState* state, struct OutputBuffer* out) {
+  if (state->event_list == NULL) {
+    fprintf(stderr, "EMS state must be initialized.\n");
     return 1;
   }
 
-  buffer[0] = '\0';
+  // Nodes are never removed and are linked once complete, and the tail is published after the link to it
+  struct ListNode* last = atomic_load_explicit(&state->event_list->tail, memory_order_acquire);
+  struct ListNode* current = last != NULL ? atomic_load_explicit(&state->event_list->head, memory_order_acquire) : NULL;
+
+  if (current == NULL) {
+    return output_write(out, "No events\n", strlen("No events\n"));
+  }
 
   while (current != NULL) {
-    if (pthread_rwlock_rdlock(&global_rwlock) != 0) {
-      fprintf(stderr, "Error locking read lock.\n");
+    char *dest = output_begin(out, LIST_CHUNK_EVENTS * LIST_LINE_MAX_CHARS);
+    if (dest == NULL) {
       return 1;
     }
 
-    char *id = malloc(IDMAX*sizeof(char));
-    if (id == NULL) {
-      fprintf(stderr, "Error allocating memory for id.\n");
-      return 1;
+    for (size_t k = 0; k < LIST_CHUNK_EVENTS && current != NULL; k++) {
+      memcpy(dest, "Event: ", strlen("Event: "));
+      dest = writeUint(dest + strlen("Event: "), current->event->id);
+      *dest++ = '\n';
+      current = current == last ? NULL : atomic_load_explicit(&current->next, memory_order_acquire);
     }
-    sprintf(id, "%u\n", (current->event)->id);
-    current = current->next;
-    
-    if (pthread_rwlock_unlock(&global_rwlock) != 0) {
-    fprintf(stderr, "Error unlocking read lock.\n");
-    return 1;
+    if (output_end(out, dest) != 0) {
+      return 1;
     }
-    strcat(buffer, "Event: ");
-    strcat(buffer, id);
-    free(id);
-  }
-
-  if (pthread_mutex_lock(&global_mutex) != 0) {
-    fprintf(stderr, "Error locking global mutex.\n");
-    return 1;
-  }
-
-  writeFile(fdWrite, buffer);
-
-  if (pthread_mutex_unlock(&global_mutex) != 0) {
-    fprintf(stderr, "Error unlocking global mutex.\n");
-    return 1;
   }
-  free(buffer);
 
   return 0;
 }
@@ -424,3 +589,19 @@ void ems_wait(unsigned int delay_ms) {
   struct timespec delay = delay_to_timespec(delay_ms);
   nanosleep(&delay, NULL);
 }
+
+void ems_deadline(struct timespec* deadline, unsigned int delay_ms) {
+  struct timespec delay = delay_to_timespec(delay_ms);
+  deadline->tv_sec += delay.tv_sec;
+  deadline->tv_nsec += delay.tv_nsec;
+  if (deadline->tv_nsec >= 1000000000) {
+    deadline->tv_sec++;
+    deadline->tv_nsec -= 1000000000;
+  }
+}
+
+void ems_wait_until(const struct timespec* deadline) {
+  // Sleeping to an absolute time, an interrupted sleep just resumes without drifting
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR) {
+  }
+}
@@ -2,41 +2,110 @@
 #define EMS_OPERATIONS_H
 
 #include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+struct EventList;
+struct OutputBuffer;
+struct SharedArena;
+
+/// State of one event management system.
+struct EMSState {
+  struct EventList* event_list;  /// Events of the system.
+  pthread_rwlock_t rwlock;       /// Serializes the CREATEs, lookups of the event list take no lock.
+  unsigned int delay_ms;         /// State access delay in milliseconds.
+  struct SharedArena* arena;     /// Shared memory holding the state, NULL for a private state.
+  int owned_events;              /// Set when each event is only used by one thread between fences,
+                                 /// so RESERVE and SHOW skip the event lock.
+  pthread_mutex_t claim_mutex;   /// Guards the sleep of reservations waiting on a tentatively claimed seat.
+  pthread_cond_t claim_cond;     /// Broadcast when a reservation with waiters commits or gives back its seats.
+  atomic_uint claim_waiters;     /// Reservations sleeping on claim_cond.
+};
 
 /// Initializes the EMS state.
+/// @param state State to be initialized.
 /// @param delay_ms State access delay in milliseconds.
 /// @return 0 if the EMS state was initialized successfully, 1 otherwise.
-int ems_init(unsigned int delay_ms);
+int ems_init(struct EMSState* state, unsigned int delay_ms);
+
+/// Creates an EMS state in shared memory, used by every process forked afterwards.
+/// @param delay_ms State access delay in milliseconds.
+/// @param size Size of the shared memory region holding the events.
+/// @return The shared state, NULL on failure.
+struct EMSState* ems_init_shared(unsigned int delay_ms, size_t size);
 
 /// Destroys the EMS state.
-int ems_terminate();
+/// @param state State to be destroyed.
+int ems_terminate(struct EMSState* state);
 
 /// Creates a new event with the given id and dimensions.
+/// @param state EMS state.
 /// @param event_id Id of the event to be created.
 /// @param num_rows Number of rows of the event to be created.
 /// @param num_cols Number of columns of the event to be created.
+/// @param order Position of the CREATE in its file, LIST prints events in this order.
 /// @return 0 if the event was created successfully, 1 otherwise.
-int ems_create(unsigned int event_id, size_t num_rows, size_t num_cols);
+int ems_create(struct EMSState* state, unsigned int event_id, size_t num_rows, size_t num_cols, size_t order);
 
 /// Creates a new reservation for the given event.
+/// @param state EMS state.
 /// @param event_id Id of the event to create a reservation for.
 /// @param num_seats Number of seats to reserve.
 /// @param xs Array of rows of the seats to reserve.
 /// @param ys Array of columns of the seats to reserve.
 /// @return 0 if the reservation was created successfully, 1 otherwise.
-int ems_reserve(unsigned int event_id, size_t num_seats, size_t *xs, size_t *ys);
+int ems_reserve(struct EMSState* state, unsigned int event_id, size_t num_seats, size_t *xs, size_t *ys);
+
+/// One reservation of a batch.
+struct ReservationRequest {
+  size_t num_seats;  /// Number of seats to reserve.
+  size_t *xs;        /// Rows of the seats to reserve.
+  size_t *ys;        /// Columns of the seats to reserve.
+  int result;        /// Set to 0 if the reservation was created, 1 otherwise.
+};
+
+/// Creates several reservations for the same event, in order.
+/// @note The event is looked up and locked once; each reservation still succeeds or fails on its
+///       own and gets its own id.
+/// @param state EMS state.
+/// @param event_id Id of the event to create the reservations for.
+/// @param requests Reservations to create.
+/// @param count Number of reservations.
+/// @return 0 if every reservation was created successfully, 1 otherwise.
+int ems_reserve_batch(struct EMSState* state, unsigned int event_id, struct ReservationRequest* requests,
+                      size_t count);
 
 /// Prints the given event.
+/// @note The seats are copied while reservations go on and the copy is retried if any ran meanwhile,
+///       so a SHOW only locks reservations out when it keeps losing that race. Events of more than
+///       a million seats are copied and printed a few thousand seats at a time, each range on its own.
+/// @param state EMS state.
 /// @param event_id Id of the event to print.
+/// @param out Output buffer of the calling thread.
 /// @return 0 if the event was printed successfully, 1 otherwise.
-int ems_show(unsigned int event_id, int fdWrite);
+int ems_show(struct EMSState* state, unsigned int event_id, struct OutputBuffer* out);
+
+/// Frees the copy of the seats the calling thread kept for its SHOWs.
+void ems_free_snapshot(void);
 
 /// Prints all the events.
+/// @param state EMS state.
+/// @param out Output buffer of the calling thread.
 /// @return 0 if the events were printed successfully, 1 otherwise.
-int ems_list_events(int fdWrite);
+int ems_list_events(struct EMSState* state, struct OutputBuffer* out);
 
 /// Waits for a given amount of time.
 /// @param delay_us Delay in milliseconds.
 void ems_wait(unsigned int delay_ms);
 
+/// Moves a CLOCK_MONOTONIC deadline forward by a delay.
+/// @param deadline Deadline to be moved.
+/// @param delay_ms Delay in milliseconds.
+void ems_deadline(struct timespec* deadline, unsigned int delay_ms);
+
+/// Waits until a CLOCK_MONOTONIC deadline has passed.
+/// @param deadline Absolute time to wake up at.
+void ems_wait_until(const struct timespec* deadline);
+
 #endif  // EMS_OPERATIONS_H
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include "output.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#define OUTPUT_IOV_MAX 1024  // Largest writev batch accepted by Linux
+
+int output_init(struct OrderedOutput *output, int fd, size_t num_buffers, atomic_size_t *progress) {
+  output->fd = fd;
+  output->num_buffers = num_buffers;
+  output->progress = progress;
+  atomic_init(&output->failed, 0);
+  output->buffers = calloc(num_buffers, sizeof(struct OutputBuffer));
+  if (output->buffers == NULL) {
+    fprintf(stderr, "Error allocating memory for the output buffers.\n");
+    return 1;
+  }
+
+  for (size_t i = 0; i < num_buffers; i++) {
+    output->buffers[i].output = output;
+    if (pthread_mutex_init(&output->buffers[i].mutex, NULL) != 0) {
+      fprintf(stderr, "Error initializing output buffer mutex.\n");
+      while (i-- > 0) pthread_mutex_destroy(&output->buffers[i].mutex);
+      free(output->buffers);
+      return 1;
+    }
+  }
+  if (pthread_mutex_init(&output->flush_mutex, NULL) != 0) {
+    fprintf(stderr, "Error initializing output flush mutex.\n");
+    for (size_t i = 0; i < num_buffers; i++) pthread_mutex_destroy(&output->buffers[i].mutex);
+    free(output->buffers);
+    return 1;
+  }
+
+  return 0;
+}
+
+void output_destroy(struct OrderedOutput *output) {
+  for (size_t i = 0; i < output->num_buffers; i++) {
+    struct OutputBuffer *out = &output->buffers[i];
+    pthread_mutex_destroy(&out->mutex);
+    free(out->data);
+    free(out->records);
+  }
+  pthread_mutex_destroy(&output->flush_mutex);
+  free(output->buffers);
+}
+
+size_t output_low_watermark(struct OrderedOutput *output) {
+  size_t lowest = SIZE_MAX;
+  for (size_t i = 0; i < output->num_buffers; i++) {
+    size_t value = atomic_load(&output->progress[i]);
+    if (value < lowest) lowest = value;
+  }
+  return lowest;
+}
+
+char* output_begin(struct OutputBuffer *out, size_t len) {
+  if (pthread_mutex_lock(&out->mutex) != 0) {
+    fprintf(stderr, "Error locking output buffer.\n");
+    return NULL;
+  }
+
+  // Output in order is written out before appending more, even in the middle of a command
+  if (out->size > OUTPUT_FLUSH_THRESHOLD) {
+    pthread_mutex_unlock(&out->mutex);
+
+    // The current command is the oldest one running, its output so far comes next in the file
+    size_t below = output_low_watermark(out->output);
+    if (below == out->seq) below++;
+    output_flush(out->output, below, 0);
+
+    if (pthread_mutex_lock(&out->mutex) != 0) {
+      fprintf(stderr, "Error locking output buffer.\n");
+      return NULL;
+    }
+  }
+
+  if (out->size + len > out->capacity) {
+    size_t new_cap = out->capacity ? out->capacity * 2 : 4096;
+    while (new_cap < out->size + len) new_cap *= 2;
+
+    char *data = realloc(out->data, new_cap);
+    if (data == NULL) {
+      fprintf(stderr, "Error allocating memory for the output buffer.\n");
+      atomic_store(&out->output->failed, 1);
+      pthread_mutex_unlock(&out->mutex);
+      return NULL;
+    }
+    out->data = data;
+    out->capacity = new_cap;
+  }
+
+  return out->data + out->size;
+}
+
+int output_end(struct OutputBuffer *out, char *end) {
+  size_t len = (size_t)(end - (out->data + out->size));
+
+  // Consecutive appends of one command extend its record
+  struct OutputRecord *last = out->num_records > 0 ? &out->records[out->num_records - 1] : NULL;
+  if (last != NULL && last->seq == out->seq && last->offset + last->len == out->size) {
+    last->len += len;
+    out->size += len;
+  } else if (len > 0) {
+    if (out->num_records == out->cap_records) {
+      size_t new_cap = out->cap_records ? out->cap_records * 2 : 64;
+      struct OutputRecord *records = realloc(out->records, new_cap * sizeof(struct OutputRecord));
+      if (records == NULL) {
+        fprintf(stderr, "Error allocating memory for the output records.\n");
+        atomic_store(&out->output->failed, 1);
+        pthread_mutex_unlock(&out->mutex);
+        return 1;
+      }
+      out->records = records;
+      out->cap_records = new_cap;
+    }
+    out->records[out->num_records++] = (struct OutputRecord){out->seq, out->size, len};
+    out->size += len;
+  }
+
+  pthread_mutex_unlock(&out->mutex);
+  return 0;
+}
+
+int output_write(struct OutputBuffer *out, const char *text, size_t len) {
+  char *dest = output_begin(out, len);
+  if (dest == NULL) return 1;
+
+  memcpy(dest, text, len);
+  return output_end(out, dest + len);
+}
+
+int output_failed(struct OrderedOutput *output) { return atomic_load(&output->failed); }
+
+int output_full(struct OutputBuffer *out) {
+  pthread_mutex_lock(&out->mutex);
+  int full = out->size > OUTPUT_FLUSH_THRESHOLD;
+  pthread_mutex_unlock(&out->mutex);
+  return full;
+}
+
+/// Writes a batch of buffers, retrying after partial writes.
+static int write_vectors(int fd, struct iovec *iov, int count) {
+  while (count > 0) {
+    ssize_t bytes_written = writev(fd, iov, count);
+    if (bytes_written < 0) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "Write error: %s\n", strerror(errno));
+      return 1;
+    }
+
+    size_t done = (size_t)bytes_written;
+    while (count > 0 && done >= iov->iov_len) {
+      done -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (char*)iov->iov_base + done;
+      iov->iov_len -= done;
+    }
+  }
+  return 0;
+}
+
+/// Drops the records that were written from the front of a buffer.
+static void compact_buffer(struct OutputBuffer *out, size_t written) {
+  if (written == 0) return;
+
+  size_t offset = written < out->num_records ? out->records[written].offset : out->size;
+  memmove(out->data, out->data + offset, out->size - offset);
+  out->size -= offset;
+
+  out->num_records -= written;
+  memmove(out->records, out->records + written, out->num_records * sizeof(struct OutputRecord));
+  for (size_t i = 0; i < out->num_records; i++) {
+    out->records[i].offset -= offset;
+  }
+}
+
+int output_flush(struct OrderedOutput *output, size_t below, int block) {
+  if (block) {
+    if (stats_mutex_lock(&output->flush_mutex, STATS_LOCK_OUTPUT) != 0) {
+      fprintf(stderr, "Error locking output flush mutex.\n");
+      return 1;
+    }
+  } else if (pthread_mutex_trylock(&output->flush_mutex) != 0) {
+    return 0;
+  }
+
+  // Writing on after lost output would leave a gap nobody notices
+  if (atomic_load(&output->failed)) {
+    pthread_mutex_unlock(&output->flush_mutex);
+    return 1;
+  }
+
+  size_t num_buffers = output->num_buffers;
+  size_t next[num_buffers];  // Next record of each buffer to be written
+  for (size_t i = 0; i < num_buffers; i++) {
+    pthread_mutex_lock(&output->buffers[i].mutex);
+    next[i] = 0;
+  }
+
+  // Merge the buffers by sequence number, joining adjacent records of one buffer
+  struct iovec iov[OUTPUT_IOV_MAX];
+  int count = 0;
+  size_t last_buffer = num_buffers;
+  int result = 0;
+  while (1) {
+    size_t best = num_buffers;
+    for (size_t i = 0; i < num_buffers; i++) {
+      struct OutputBuffer *out = &output->buffers[i];
+      if (next[i] < out->num_records && out->records[next[i]].seq < below &&
+          (best == num_buffers || out->records[next[i]].seq < output->buffers[best].records[next[best]].seq)) {
+        best = i;
+      }
+    }
+    if (best == num_buffers) break;
+
+    struct OutputRecord *record = &output->buffers[best].records[next[best]++];
+    char *base = output->buffers[best].data + record->offset;
+    if (count > 0 && last_buffer == best && (char*)iov[count - 1].iov_base + iov[count - 1].iov_len == base) {
+      iov[count - 1].iov_len += record->len;
+      continue;
+    }
+
+    if (count == OUTPUT_IOV_MAX) {
+      if (write_vectors(output->fd, iov, count) != 0) result = 1;
+      count = 0;
+    }
+    iov[count++] = (struct iovec){base, record->len};
+    last_buffer = best;
+  }
+  if (count > 0 && write_vectors(output->fd, iov, count) != 0) result = 1;
+
+  for (size_t i = 0; i < num_buffers; i++) {
+    compact_buffer(&output->buffers[i], next[i]);
+    pthread_mutex_unlock(&output->buffers[i].mutex);
+  }
+  pthread_mutex_unlock(&output->flush_mutex);
+
+  return result;
+}
@@ -0,0 +1,94 @@
+#ifndef EMS_OUTPUT_H
+#define EMS_OUTPUT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define OUTPUT_FLUSH_THRESHOLD 262144  // Pending bytes that make a thread try to flush early
+
+struct OrderedOutput;
+
+/// Output of one command, stored in its thread's buffer.
+struct OutputRecord {
+  size_t seq;     /// Index of the command in the command stream.
+  size_t offset;  /// Start of the output in the buffer.
+  size_t len;     /// Length of the output.
+};
+
+/// Append buffer of one worker thread.
+struct OutputBuffer {
+  pthread_mutex_t mutex;  /// Held by the owner while appending and by a thread draining the buffer.
+  char *data;
+  size_t size;
+  size_t capacity;
+
+  struct OutputRecord *records;  /// Pending output, in increasing sequence order.
+  size_t num_records;
+  size_t cap_records;
+
+  size_t seq;  /// Sequence number of the command being executed by the owner.
+  struct OrderedOutput *output;  /// Output file the buffer belongs to.
+};
+
+/// Output file shared by the threads of a worker pool.
+struct OrderedOutput {
+  int fd;
+  struct OutputBuffer *buffers;  /// One buffer per thread.
+  size_t num_buffers;
+  pthread_mutex_t flush_mutex;   /// Serializes flushes, so the file is written in sequence order.
+  atomic_size_t *progress;       /// First command the owner of each buffer may still be running.
+  atomic_int failed;             /// Set once output was lost, after which nothing more is written.
+};
+
+/// Initializes the buffers of an output file.
+/// @param output Output to be initialized.
+/// @param fd File descriptor of the output file.
+/// @param num_buffers Number of buffers, one per thread.
+/// @param progress First command the owner of each buffer may still be running, SIZE_MAX for no owner.
+/// @return 0 if the output was initialized successfully, 1 otherwise.
+int output_init(struct OrderedOutput *output, int fd, size_t num_buffers, atomic_size_t *progress);
+
+/// Releases the buffers of an output file, discarding pending output.
+/// @param output Output to be released.
+void output_destroy(struct OrderedOutput *output);
+
+/// Reserves space at the end of a buffer for the current command.
+/// @note The buffer stays locked until output_end is called. A buffer over OUTPUT_FLUSH_THRESHOLD is
+///       flushed first, including the output of the current command so far when every command before
+///       it has finished, so one long SHOW or LIST does not pile up in memory.
+/// @param out Buffer to append to.
+/// @param len Maximum number of bytes that will be written.
+/// @return Where the output must be written, NULL on failure.
+char* output_begin(struct OutputBuffer *out, size_t len);
+
+/// Ends an append started by output_begin.
+/// @note If the output can not be recorded the whole output is marked as failed, see output_failed.
+/// @param out Buffer being appended to.
+/// @param end Pointer just past the last byte written.
+/// @return 0 if the output was recorded successfully, 1 otherwise.
+int output_end(struct OutputBuffer *out, char *end);
+
+/// Appends output of the current command to a buffer.
+/// @return 0 if the output was appended successfully, 1 otherwise.
+int output_write(struct OutputBuffer *out, const char *text, size_t len);
+
+/// Checks whether output of a file was lost, in which case the rest of the file is not worth running.
+int output_failed(struct OrderedOutput *output);
+
+/// Checks whether a buffer holds more than OUTPUT_FLUSH_THRESHOLD pending bytes.
+int output_full(struct OutputBuffer *out);
+
+/// Finds the first command that may still be running in any thread.
+size_t output_low_watermark(struct OrderedOutput *output);
+
+/// Writes to the file the pending output of every command before a sequence number, in order.
+/// @note Every command with a lower sequence number must have finished. Once output was lost nothing
+///       more is written, so the file never has a gap in the middle.
+/// @param output Output to be flushed.
+/// @param below Sequence number of the first command that is not written.
+/// @param block Whether to wait for a flush in progress, otherwise the flush is skipped.
+/// @return 0 if the output was written successfully, 1 otherwise.
+int output_flush(struct OrderedOutput *output, size_t below, int block);
+
+#endif  // EMS_OUTPUT_H
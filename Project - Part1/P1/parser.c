@@ -6,30 +6,101 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-static int read_uint(int fd, unsigned int *value, char *next) {
-  char buf[16];
+#define COORD_MAX_DIGITS 9        // Longest number the line decoder converts, it can never overflow
+#define SEAT_BUFFER_INITIAL 1024  // Seats a buffer holds when it is first allocated
+
+int open_job_file(struct JobFile *file, const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return 1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return 1;
+  }
+
+  file->data = NULL;
+  file->size = (size_t)st.st_size;
+  file->pos = 0;
+
+  // An empty file cannot be mapped, it simply has no commands
+  if (file->size > 0) {
+    void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return 1;
+    }
+    posix_madvise(data, file->size, POSIX_MADV_SEQUENTIAL);
+    file->data = data;
+  }
+
+  // The mapping stays valid after the descriptor is closed
+  if (close(fd) == -1) {
+    close_job_file(file);
+    return 1;
+  }
+
+  return 0;
+}
+
+int close_job_file(struct JobFile *file) {
+  if (file->data != NULL && munmap((void *)file->data, file->size) == -1) {
+    return 1;
+  }
+
+  file->data = NULL;
+  file->size = 0;
+  file->pos = 0;
+  return 0;
+}
+
+/// Copies up to n bytes from the cursor, like read() would.
+/// @return Number of bytes copied.
+static size_t read_bytes(struct JobFile *file, char *buf, size_t n) {
+  size_t available = file->size - file->pos;
+  if (n > available) n = available;
+
+  memcpy(buf, file->data + file->pos, n);
+  file->pos += n;
+  return n;
+}
+
+static int read_char(struct JobFile *file, char *ch) {
+  if (file->pos == file->size) return 0;
+
+  *ch = file->data[file->pos++];
+  return 1;
+}
+
+static int read_uint(struct JobFile *file, unsigned int *value, char *next) {
+  unsigned long ul = 0;
+  int overflow = 0;
 
-  int i = 0;
   while (1) {
-    if (read(fd, buf + i, 1) == 0) {
+    if (!read_char(file, next)) {
       *next = '\0';
       break;
     }
 
-    *next = buf[i];
-
-    if (buf[i] > '9' || buf[i] < '0') {
-      buf[i] = '\0';
+    if (*next > '9' || *next < '0') {
       break;
     }
 
-    i++;
+    ul = ul * 10 + (unsigned long)(*next - '0');
+    if (ul > UINT_MAX) {
+      // Keep consuming the digits so the cursor ends after the number
+      overflow = 1;
+      ul = UINT_MAX;
+    }
   }
 
-  unsigned long ul = strtoul(buf, NULL, 10);
-
-  if (ul > UINT_MAX) {
+  if (overflow) {
     return 1;
   }
 
@@ -38,119 +109,122 @@ static int read_uint(int fd, unsigned int *value, char *next) {
   return 0;
 }
 
-static void cleanup(int fd) {
-  char ch;
-  while (read(fd, &ch, 1) == 1 && ch != '\n')
-    ;
+static void cleanup(struct JobFile *file) {
+  const char *newline = NULL;
+  if (file->pos < file->size) {
+    newline = memchr(file->data + file->pos, '\n', file->size - file->pos);
+  }
+
+  file->pos = newline != NULL ? (size_t)(newline - file->data) + 1 : file->size;
 }
 
-enum Command get_next(int fd) {
+enum Command get_next(struct JobFile *file) {
   char buf[16];
-  if (read(fd, buf, 1) != 1) {
+  if (!read_char(file, buf)) {
     return EOC;
   }
 
   switch (buf[0]) {
     case 'C':
-      if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "CREATE ", 7) != 0) {
-        cleanup(fd);
+      if (read_bytes(file, buf + 1, 6) != 6 || strncmp(buf, "CREATE ", 7) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
       return CMD_CREATE;
 
     case 'R':
-      if (read(fd, buf + 1, 7) != 7 || strncmp(buf, "RESERVE ", 8) != 0) {
-        cleanup(fd);
+      if (read_bytes(file, buf + 1, 7) != 7 || strncmp(buf, "RESERVE ", 8) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
       return CMD_RESERVE;
 
     case 'S':
-      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "SHOW ", 5) != 0) {
-        cleanup(fd);
+      if (read_bytes(file, buf + 1, 4) != 4 || strncmp(buf, "SHOW ", 5) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_SHOW;
 
     case 'L':
-      if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "LIST", 4) != 0) {
-        cleanup(fd);
+      if (read_bytes(file, buf + 1, 3) != 3 || strncmp(buf, "LIST", 4) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
-        cleanup(fd);
+      if (read_bytes(file, buf + 4, 1) != 0 && buf[4] != '\n') {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_LIST_EVENTS;
 
     case 'B':
-      if (read(fd, buf + 1, 6) != 6 || strncmp(buf, "BARRIER", 7) != 0) {
-        cleanup(fd);
+      if (read_bytes(file, buf + 1, 6) != 6 || strncmp(buf, "BARRIER", 7) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 7, 1) != 0 && buf[7] != '\n') {
-        cleanup(fd);
+      if (read_bytes(file, buf + 7, 1) != 0 && buf[7] != '\n') {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_BARRIER;
 
     case 'W':
-      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
-        cleanup(fd);
+      if (read_bytes(file, buf + 1, 4) != 4 || strncmp(buf, "WAIT ", 5) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_WAIT;
 
     case 'H':
-      if (read(fd, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
-        cleanup(fd);
+      if (read_bytes(file, buf + 1, 3) != 3 || strncmp(buf, "HELP", 4) != 0) {
+        cleanup(file);
         return CMD_INVALID;
       }
 
-      if (read(fd, buf + 4, 1) != 0 && buf[4] != '\n') {
-        cleanup(fd);
+      if (read_bytes(file, buf + 4, 1) != 0 && buf[4] != '\n') {
+        cleanup(file);
         return CMD_INVALID;
       }
 
       return CMD_HELP;
 
     case '#':
-      cleanup(fd);
+      cleanup(file);
       return CMD_EMPTY;
 
     case '\n':
       return CMD_EMPTY;
 
     default:
-      cleanup(fd);
+      cleanup(file);
       return CMD_INVALID;
   }
 }
 
-int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_cols) {
+int parse_create(struct JobFile *file, unsigned int *event_id, size_t *num_rows, size_t *num_cols) {
   char ch;
 
-  if (read_uint(fd, event_id, &ch) != 0 || ch != ' ') {
-    cleanup(fd);
+  if (read_uint(file, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(file);
     return 1;
   }
 
   unsigned int u_num_rows;
-  if (read_uint(fd, &u_num_rows, &ch) != 0 || ch != ' ') {
-    cleanup(fd);
+  if (read_uint(file, &u_num_rows, &ch) != 0 || ch != ' ') {
+    cleanup(file);
     return 1;
   }
   *num_rows = (size_t)u_num_rows;
 
   unsigned int u_num_cols;
-  if (read_uint(fd, &u_num_cols, &ch) != 0 || (ch != '\n' && ch != '\0')) {
-    cleanup(fd);
+  if (read_uint(file, &u_num_cols, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+    cleanup(file);
     return 1;
   }
   *num_cols = (size_t)u_num_cols;
@@ -159,44 +233,137 @@ int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_c
   return 0;
 }
 
-size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, size_t *ys) {
+/// Reads the digits of a number inside a line, stopping at the first other byte.
+/// @note The value is only meaningful for up to COORD_MAX_DIGITS digits.
+/// @return Number of digits read.
+static size_t read_digits(const char **cursor, unsigned int *value) {
+  const char *start = *cursor, *p = start;
+  unsigned int result = 0;
+  while ((unsigned char)(*p - '0') < 10) {
+    result = result * 10 + (unsigned int)(*p++ - '0');
+  }
+
+  *cursor = p;
+  *value = result;
+  return (size_t)(p - start);
+}
+
+int seat_buffer_grow(struct SeatBuffer *seats, size_t extra) {
+  if (seats->count + extra <= seats->capacity) return 0;
+
+  size_t new_cap = seats->capacity ? seats->capacity * 2 : SEAT_BUFFER_INITIAL;
+  while (new_cap < seats->count + extra) new_cap *= 2;
+
+  size_t *xs = realloc(seats->xs, new_cap * sizeof(size_t));
+  if (xs == NULL) {
+    seats->failed = 1;
+    return 1;
+  }
+  seats->xs = xs;
+
+  size_t *ys = realloc(seats->ys, new_cap * sizeof(size_t));
+  if (ys == NULL) {
+    seats->failed = 1;
+    return 1;
+  }
+  seats->ys = ys;
+
+  seats->capacity = new_cap;
+  return 0;
+}
+
+/// Decodes a well formed coordinate list, "(x,y) (x,y)]" and a newline, in one pass over the line.
+/// The newline is found first with memchr, which scans a vector at a time, and every number stops
+/// at a delimiter before it, so the bytes are read without checking for the end of the file.
+/// @note Anything unusual (empty or long numbers, stray bytes) is left to the scalar parser,
+///       which reports it exactly as before.
+/// @return Number of coordinates appended with the cursor after the line, 0 to use the scalar parser.
+static size_t decode_coords(struct JobFile *file, struct SeatBuffer *seats) {
+  const char *p = file->data + file->pos;
+  const char *newline = memchr(p, '\n', file->size - file->pos);
+  if (newline == NULL) return 0;
+
+  // Every seat takes at least six bytes, "(x,y) ", so the line bounds the seats it holds
+  if (seat_buffer_grow(seats, (size_t)(newline - p) / 6 + 1) != 0) return 0;
+  size_t *xs = seats->xs + seats->count;
+  size_t *ys = seats->ys + seats->count;
+
+  for (size_t num_coords = 0;; num_coords++) {
+    unsigned int x, y;
+    if (*p++ != '(') return 0;
+
+    size_t len = read_digits(&p, &x);
+    if (len == 0 || len > COORD_MAX_DIGITS || *p++ != ',') return 0;
+
+    len = read_digits(&p, &y);
+    if (len == 0 || len > COORD_MAX_DIGITS || *p++ != ')') return 0;
+
+    xs[num_coords] = (size_t)x;
+    ys[num_coords] = (size_t)y;
+
+    if (*p == ']') {
+      if (p + 1 != newline) return 0;
+      file->pos = (size_t)(newline - file->data) + 1;
+      seats->count += num_coords + 1;
+      return num_coords + 1;
+    }
+    if (*p++ != ' ') return 0;
+  }
+}
+
+size_t parse_reserve(struct JobFile *file, unsigned int *event_id, struct SeatBuffer *seats) {
   char ch;
 
-  if (read_uint(fd, event_id, &ch) != 0 || ch != ' ') {
-    cleanup(fd);
+  if (read_uint(file, event_id, &ch) != 0 || ch != ' ') {
+    cleanup(file);
     return 0;
   }
 
-  if (read(fd, &ch, 1) != 1 || ch != '[') {
-    cleanup(fd);
+  if (!read_char(file, &ch) || ch != '[') {
+    cleanup(file);
     return 0;
   }
 
-  size_t num_coords = 0;
-  while (num_coords < max) {
-    if (read(fd, &ch, 1) != 1 || ch != '(') {
-      cleanup(fd);
+  // Almost every list is well formed and takes the fast path
+  size_t decoded = decode_coords(file, seats);
+  if (decoded > 0 || seats->failed) {
+    return decoded;
+  }
+
+  size_t first = seats->count;
+  while (1) {
+    if (seat_buffer_grow(seats, 1) != 0) {
+      seats->count = first;
+      return 0;
+    }
+
+    if (!read_char(file, &ch) || ch != '(') {
+      cleanup(file);
+      seats->count = first;
       return 0;
     }
 
     unsigned int x;
-    if (read_uint(fd, &x, &ch) != 0 || ch != ',') {
-      cleanup(fd);
+    if (read_uint(file, &x, &ch) != 0 || ch != ',') {
+      cleanup(file);
+      seats->count = first;
       return 0;
     }
-    xs[num_coords] = (size_t)x;
+    seats->xs[seats->count] = (size_t)x;
 
     unsigned int y;
-    if (read_uint(fd, &y, &ch) != 0 || ch != ')') {
-      cleanup(fd);
+    if (read_uint(file, &y, &ch) != 0 || ch != ')') {
+      cleanup(file);
+      seats->count = first;
       return 0;
     }
-    ys[num_coords] = (size_t)y;
+    seats->ys[seats->count] = (size_t)y;
 
-    num_coords++;
+    seats->count++;
 
-    if (read(fd, &ch, 1) != 1 || (ch != ' ' && ch != ']')) {
-      cleanup(fd);
+    if (!read_char(file, &ch) || (ch != ' ' && ch != ']')) {
+      cleanup(file);
+      seats->count = first;
       return 0;
     }
 
@@ -205,46 +372,42 @@ size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, siz
     }
   }
 
-  if (num_coords == max) {
-    cleanup(fd);
-    return 0;
-  }
-
-  if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
-    cleanup(fd);
+  if (!read_char(file, &ch) || (ch != '\n' && ch != '\0')) {
+    cleanup(file);
+    seats->count = first;
     return 0;
   }
 
-  return num_coords;
+  return seats->count - first;
 }
 
-int parse_show(int fd, unsigned int *event_id) {
+int parse_show(struct JobFile *file, unsigned int *event_id) {
   char ch;
 
-  if (read_uint(fd, event_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
-    cleanup(fd);
+  if (read_uint(file, event_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+    cleanup(file);
     return 1;
   }
 
   return 0;
 }
 
-int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id) {
+int parse_wait(struct JobFile *file, unsigned int *delay, unsigned int *thread_id) {
   char ch;
 
-  if (read_uint(fd, delay, &ch) != 0) {
-    cleanup(fd);
+  if (read_uint(file, delay, &ch) != 0) {
+    cleanup(file);
     return -1;
   }
 
   if (ch == ' ') {
     if (thread_id == NULL) {
-      cleanup(fd);
+      cleanup(file);
       return 0;
     }
 
-    if (read_uint(fd, thread_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
-      cleanup(fd);
+    if (read_uint(file, thread_id, &ch) != 0 || (ch != '\n' && ch != '\0')) {
+      cleanup(file);
       return -1;
     }
 
@@ -252,7 +415,7 @@ int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id) {
   } else if (ch == '\n' || ch == '\0') {
     return 0;
   } else {
-    cleanup(fd);
+    cleanup(file);
     return -1;
   }
 }
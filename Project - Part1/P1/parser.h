@@ -16,39 +16,70 @@ enum Command {
   EOC  // End of commands
 };
 
+/// Job file mapped in memory and scanned through a cursor.
+struct JobFile {
+  const char *data;  /// Contents of the file (NULL if the file is empty).
+  size_t size;       /// Size of the file in bytes.
+  size_t pos;        /// Position of the next byte to be read.
+};
+
+/// Maps a job file in memory for parsing.
+/// @param file Job file to be initialized.
+/// @param path Path of the file to open.
+/// @return 0 if the file was mapped successfully, 1 otherwise.
+int open_job_file(struct JobFile *file, const char *path);
+
+/// Unmaps a job file.
+/// @param file Job file to be released.
+/// @return 0 if the file was released successfully, 1 otherwise.
+int close_job_file(struct JobFile *file);
+
 /// Reads a line and returns the corresponding command.
-/// @param fd File descriptor to read from.
+/// @param file Job file to read from.
 /// @return The command read.
-enum Command get_next(int fd);
+enum Command get_next(struct JobFile *file);
 
 /// Parses a CREATE command.
-/// @param fd File descriptor to read from.
+/// @param file Job file to read from.
 /// @param event_id Pointer to the variable to store the event ID in.
 /// @param num_rows Pointer to the variable to store the number of rows in.
 /// @param num_cols Pointer to the variable to store the number of columns in.
 /// @return 0 if the command was parsed successfully, 1 otherwise.
-int parse_create(int fd, unsigned int *event_id, size_t *num_rows, size_t *num_cols);
+int parse_create(struct JobFile *file, unsigned int *event_id, size_t *num_rows, size_t *num_cols);
+
+/// Seat coordinates of the RESERVEs of a job file, grown as needed and reused by every command.
+struct SeatBuffer {
+  size_t *xs;       /// Rows of the seats.
+  size_t *ys;       /// Columns of the seats.
+  size_t count;     /// Number of seats stored.
+  size_t capacity;  /// Number of seats that fit before the buffer grows.
+  int failed;       /// Set when growing the buffer ran out of memory.
+};
+
+/// Makes room for more seats at the end of a buffer.
+/// @param seats Buffer to grow.
+/// @param extra Number of seats to make room for.
+/// @return 0 if the buffer has room, 1 if it could not grow.
+int seat_buffer_grow(struct SeatBuffer *seats, size_t extra);
 
-/// Parses a RESERVE command.
-/// @param fd File descriptor to read from.
-/// @param max Maximum number of coordinates to read.
+/// Parses a RESERVE command, of any number of seats.
+/// @param file Job file to read from.
 /// @param event_id Pointer to the variable to store the event ID in.
-/// @param xs Pointer to the array to store the X coordinates in.
-/// @param ys Pointer to the array to store the Y coordinates in.
-/// @return Number of coordinates read. 0 on failure.
-size_t parse_reserve(int fd, size_t max, unsigned int *event_id, size_t *xs, size_t *ys);
+/// @param seats Buffer the seats are appended to.
+/// @return Number of coordinates read. 0 on failure, with seats->failed set if memory ran out.
+size_t parse_reserve(struct JobFile *file, unsigned int *event_id, struct SeatBuffer *seats);
 
 /// Parses a SHOW command.
-/// @param fd File descriptor to read from.
+/// @param file Job file to read from.
 /// @param event_id Pointer to the variable to store the event ID in.
 /// @return 0 if the command was parsed successfully, 1 otherwise.
-int parse_show(int fd, unsigned int *event_id);
+int parse_show(struct JobFile *file, unsigned int *event_id);
 
 /// Parses a WAIT command.
-/// @param fd File descriptor to read from.
+/// @param file Job file to read from.
 /// @param delay Pointer to the variable to store the wait delay in.
 /// @param thread_id Pointer to the variable to store the thread ID in. May not be set.
 /// @return 0 if no thread was specified, 1 if a thread was specified, -1 on error.
-int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id);
+int parse_wait(struct JobFile *file, unsigned int *delay, unsigned int *thread_id);
 
 #endif  // EMS_PARSER_H
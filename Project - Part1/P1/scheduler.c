@@ -0,0 +1,211 @@
+#include "scheduler.h"
+#include "affinity.h"
+#include "autotune.h"
+#include "main.h"
+#include "auxFunctions.h"
+
+#include <dirent.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+struct Scheduler {
+  struct TaskDeque *deques;
+  int num_workers;
+  atomic_int failed;
+};
+
+typedef struct {
+  int worker_id;
+  struct Scheduler *scheduler;
+} FileWorkerParameters;
+
+static struct FileTask* pop_task(struct TaskDeque *deque) {
+  struct FileTask *task = NULL;
+
+  pthread_mutex_lock(&deque->mutex);
+  if (deque->head < deque->tail) {
+    task = deque->tasks[deque->head++];
+  }
+  pthread_mutex_unlock(&deque->mutex);
+
+  return task;
+}
+
+static struct FileTask* steal_task(struct TaskDeque *deque) {
+  struct FileTask *task = NULL;
+
+  pthread_mutex_lock(&deque->mutex);
+  if (deque->head < deque->tail) {
+    task = deque->tasks[--deque->tail];
+  }
+  pthread_mutex_unlock(&deque->mutex);
+
+  return task;
+}
+
+/* Function that processes files until every deque is empty */
+static void* file_worker(void *args) {
+  FileWorkerParameters *parameters = (FileWorkerParameters*)args;
+  struct Scheduler *scheduler = parameters->scheduler;
+  int id = parameters->worker_id;
+
+  // The threads of every file this worker runs stay on its CPUs
+  affinity_pin_group(id);
+
+  while (1) {
+    struct FileTask *task = pop_task(&scheduler->deques[id]);
+
+    // No files left of its own, take the smallest pending file of another worker
+    for (int k = 1; task == NULL && k < scheduler->num_workers; k++) {
+      task = steal_task(&scheduler->deques[(id + k) % scheduler->num_workers]);
+    }
+    if (task == NULL) {
+      return NULL;
+    }
+
+    // How long the file took steers the threads of the next ones
+    int num_threads = autotune_threads(task->size);
+    uint64_t start = autotune_clock();
+    if (process_file(task->pathJobs, task->pathOut, num_threads) != 0) {
+      fprintf(stderr, "Error processing file: %s\n", task->pathJobs);
+      atomic_store(&scheduler->failed, 1);
+    }
+    autotune_record(num_threads, task->size, autotune_clock() - start);
+  }
+}
+
+static int compare_tasks(const void *a, const void *b) {
+  const struct FileTask *first = (const struct FileTask*)a;
+  const struct FileTask *second = (const struct FileTask*)b;
+
+  if (first->size == second->size) return 0;
+  return first->size < second->size ? 1 : -1;
+}
+
+/// Collects the job files of a directory.
+/// @return Array of tasks, NULL on failure.
+static struct FileTask* collect_tasks(char *directoryPath, size_t *num_tasks) {
+  DIR *dir = opendir(directoryPath);
+  if (dir == NULL) {
+    perror("Error opening directory");
+    return NULL;
+  }
+
+  size_t capacity = 16;
+  struct FileTask *tasks = malloc(capacity * sizeof(struct FileTask));
+  *num_tasks = 0;
+  if (tasks == NULL) {
+    fprintf(stderr, "Error: Failed to allocate memory\n");
+  }
+
+  struct dirent *entry;
+  while (tasks != NULL && (entry = readdir(dir)) != NULL) {
+    if (!isJobFile(directoryPath, entry)) continue;
+
+    if (*num_tasks == capacity) {
+      capacity *= 2;
+      struct FileTask *grown = realloc(tasks, capacity * sizeof(struct FileTask));
+      if (grown == NULL) {
+        fprintf(stderr, "Error: Failed to allocate memory\n");
+        break;
+      }
+      tasks = grown;
+    }
+
+    struct FileTask *task = &tasks[*num_tasks];
+    task->pathJobs = pathingJobs(directoryPath, entry);
+    task->pathOut = pathingOut(directoryPath, entry);
+    if (task->pathJobs == NULL || task->pathOut == NULL) {
+      free(task->pathJobs);
+      free(task->pathOut);
+      continue;
+    }
+
+    struct stat st;
+    task->size = stat(task->pathJobs, &st) == 0 ? (size_t)st.st_size : 0;
+    (*num_tasks)++;
+  }
+
+  closedir(dir);
+  return tasks;
+}
+
+static void free_tasks(struct FileTask *tasks, size_t num_tasks) {
+  for (size_t i = 0; i < num_tasks; i++) {
+    free(tasks[i].pathJobs);
+    free(tasks[i].pathOut);
+  }
+  free(tasks);
+}
+
+int schedule_files(char *directoryPath, int num_workers) {
+  size_t num_tasks;
+  struct FileTask *tasks = collect_tasks(directoryPath, &num_tasks);
+  if (tasks == NULL) {
+    return 1;
+  }
+
+  // Largest files first, so a long file does not start last and keep the others waiting
+  qsort(tasks, num_tasks, sizeof(struct FileTask), compare_tasks);
+
+  struct Scheduler scheduler;
+  scheduler.num_workers = num_workers;
+  atomic_init(&scheduler.failed, 0);
+  scheduler.deques = calloc((size_t)num_workers, sizeof(struct TaskDeque));
+  struct FileTask **slots = malloc((num_tasks + 1) * sizeof(struct FileTask*));
+  if (scheduler.deques == NULL || slots == NULL) {
+    fprintf(stderr, "Error: Failed to allocate memory\n");
+    free(scheduler.deques);
+    free(slots);
+    free_tasks(tasks, num_tasks);
+    return 1;
+  }
+
+  // Deal the files round robin, so every deque starts with a large one
+  size_t used = 0;
+  for (int i = 0; i < num_workers; i++) {
+    struct TaskDeque *deque = &scheduler.deques[i];
+    deque->tasks = slots + used;
+    for (size_t t = (size_t)i; t < num_tasks; t += (size_t)num_workers) {
+      deque->tasks[deque->tail++] = &tasks[t];
+    }
+    used += deque->tail;
+    pthread_mutex_init(&deque->mutex, NULL);
+  }
+
+  pthread_t threads[num_workers];
+  FileWorkerParameters parameters[num_workers];
+  int created = 0;
+  for (int i = 0; i < num_workers; i++) {
+    parameters[i].worker_id = i;
+    parameters[i].scheduler = &scheduler;
+    if (pthread_create(&threads[i], NULL, file_worker, &parameters[i]) != 0) {
+      perror("Error creating thread");
+      break;
+    }
+    created++;
+  }
+
+  // Deques of workers that could not be created are stolen by the others
+  if (created == 0) {
+    file_worker(&parameters[0]);
+  }
+  for (int i = 0; i < created; i++) {
+    if (pthread_join(threads[i], NULL) != 0) {
+      perror("Error waiting for thread to finish.");
+      atomic_store(&scheduler.failed, 1);
+    }
+  }
+
+  for (int i = 0; i < num_workers; i++) {
+    pthread_mutex_destroy(&scheduler.deques[i].mutex);
+  }
+  free(scheduler.deques);
+  free(slots);
+  free_tasks(tasks, num_tasks);
+
+  return atomic_load(&scheduler.failed);
+}
@@ -0,0 +1,29 @@
+#ifndef EMS_SCHEDULER_H
+#define EMS_SCHEDULER_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/// A job file waiting to be processed.
+struct FileTask {
+  char *pathJobs;
+  char *pathOut;
+  size_t size;  /// Size of the job file, larger files are started first.
+};
+
+/// Tasks owned by one worker. The owner takes from the front, thieves from the back.
+struct TaskDeque {
+  pthread_mutex_t mutex;
+  struct FileTask **tasks;
+  size_t head;
+  size_t tail;
+};
+
+/// Runs every job file of a directory in worker threads of the current process.
+/// @note Each worker owns a deque of files and steals from the others once it is empty.
+/// @param directoryPath Directory with the job files.
+/// @param num_workers Number of files processed at the same time.
+/// @return 0 if every file was processed successfully, 1 otherwise.
+int schedule_files(char *directoryPath, int num_workers);
+
+#endif  // EMS_SCHEDULER_H
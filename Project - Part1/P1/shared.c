@@ -0,0 +1,131 @@
+// MAP_ANONYMOUS and MAP_NORESERVE are not part of POSIX
+#define _DEFAULT_SOURCE
+
+#include "shared.h"
+
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define ARENA_ALIGNMENT alignof(max_align_t)
+
+/// Rounds a size up to the arena alignment.
+static size_t align_size(size_t size) { return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1); }
+
+size_t arena_default_size(void) {
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (pages <= 0 || page_size <= 0 || (size_t)pages > SIZE_MAX / (size_t)page_size) return SHARED_STORE_MIN_SIZE;
+
+  size_t size = (size_t)pages * (size_t)page_size;
+  return size > SHARED_STORE_MIN_SIZE ? size : SHARED_STORE_MIN_SIZE;
+}
+
+struct SharedArena* arena_create(size_t size) {
+  void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (data == MAP_FAILED) {
+    perror("Error mapping shared event store");
+    return NULL;
+  }
+
+  struct SharedArena* arena = data;
+  atomic_init(&arena->used, align_size(sizeof(struct SharedArena)));
+  arena->size = size;
+  return arena;
+}
+
+void arena_destroy(struct SharedArena* arena) {
+  if (munmap(arena, arena->size) != 0) {
+    perror("Error unmapping shared event store");
+  }
+}
+
+void* arena_alloc(struct SharedArena* arena, size_t size) {
+  if (arena == NULL) return calloc(1, size);
+
+  // Fresh pages of an anonymous mapping are zeroed and arena memory is never reused
+  size = align_size(size);
+  size_t offset = atomic_fetch_add(&arena->used, size);
+  if (offset > arena->size || arena->size - offset < size) {
+    fprintf(stderr, "Shared event store is full.\n");
+    return NULL;
+  }
+  return (char*)arena + offset;
+}
+
+void arena_free(struct SharedArena* arena, void* ptr) {
+  if (arena == NULL) free(ptr);
+}
+
+void* arena_alloc_block(struct SharedArena* arena, size_t size) {
+  if (size > SIZE_MAX - CACHE_LINE_SIZE) return NULL;
+
+  if (arena != NULL) {
+    char* data = arena_alloc(arena, size + CACHE_LINE_SIZE - 1);
+    if (data == NULL) return NULL;
+    return (void*)(((uintptr_t)data + CACHE_LINE_SIZE - 1) & ~(uintptr_t)(CACHE_LINE_SIZE - 1));
+  }
+
+  if (size >= ARENA_MAP_THRESHOLD) {
+    void* block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return block != MAP_FAILED ? block : NULL;
+  }
+
+  size_t rounded = (size + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+  void* block = aligned_alloc(CACHE_LINE_SIZE, rounded);
+  if (block != NULL) memset(block, 0, rounded);
+  return block;
+}
+
+void arena_free_block(struct SharedArena* arena, void* block, size_t size) {
+  if (arena != NULL || block == NULL) return;
+
+  if (size >= ARENA_MAP_THRESHOLD) {
+    munmap(block, size);
+  } else {
+    free(block);
+  }
+}
+
+int arena_rwlock_init(struct SharedArena* arena, pthread_rwlock_t* rwlock) {
+  if (arena == NULL) return pthread_rwlock_init(rwlock, NULL);
+
+  pthread_rwlockattr_t attr;
+  int result = pthread_rwlockattr_init(&attr);
+  if (result != 0) return result;
+
+  result = pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  if (result == 0) result = pthread_rwlock_init(rwlock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  return result;
+}
+
+int arena_cond_init(struct SharedArena* arena, pthread_mutex_t* mutex, pthread_cond_t* cond) {
+  pthread_mutexattr_t mutex_attr;
+  pthread_condattr_t cond_attr;
+  int result = pthread_mutexattr_init(&mutex_attr);
+  if (result != 0) return result;
+  result = pthread_condattr_init(&cond_attr);
+  if (result != 0) {
+    pthread_mutexattr_destroy(&mutex_attr);
+    return result;
+  }
+
+  if (arena != NULL) {
+    result = pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    if (result == 0) result = pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+  }
+  if (result == 0) result = pthread_mutex_init(mutex, &mutex_attr);
+  if (result == 0) {
+    result = pthread_cond_init(cond, &cond_attr);
+    if (result != 0) pthread_mutex_destroy(mutex);
+  }
+
+  pthread_condattr_destroy(&cond_attr);
+  pthread_mutexattr_destroy(&mutex_attr);
+  return result;
+}
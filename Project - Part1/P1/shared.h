@@ -0,0 +1,56 @@
+#ifndef EMS_SHARED_H
+#define EMS_SHARED_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define SHARED_STORE_MIN_SIZE ((size_t)1 << 30)  // Smallest address space reserved for the shared event store
+#define ARENA_MAP_THRESHOLD ((size_t)1 << 17)  // Blocks this large get fresh zeroed pages
+#define CACHE_LINE_SIZE 64
+
+/// Bump allocator over a shared anonymous mapping.
+/// @note Created before forking, so every process sees it at the same address and pointers
+///       into it stay valid everywhere. Memory is never given back until the arena is destroyed.
+struct SharedArena {
+  atomic_size_t used;  /// Bytes handed out, including this header.
+  size_t size;         /// Size of the mapping.
+};
+
+/// Gets the default size of a shared arena: the physical memory of the machine, which is as much as the
+/// events could ever fill, and at least SHARED_STORE_MIN_SIZE.
+size_t arena_default_size(void);
+
+/// Maps a new shared arena.
+/// @param size Size of the arena; pages are only committed when touched.
+/// @return Newly created arena, NULL on failure.
+struct SharedArena* arena_create(size_t size);
+
+/// Unmaps an arena and everything allocated from it.
+void arena_destroy(struct SharedArena* arena);
+
+/// Allocates zeroed memory from an arena, or from the heap when the arena is NULL.
+/// @return Pointer to the memory, NULL on failure.
+void* arena_alloc(struct SharedArena* arena, size_t size);
+
+/// Releases memory from arena_alloc; memory of an arena is only released with the arena.
+void arena_free(struct SharedArena* arena, void* ptr);
+
+/// Allocates a zeroed, cache line aligned block from an arena, or outside of it when the arena is NULL.
+/// @note Outside of an arena, blocks of ARENA_MAP_THRESHOLD bytes or more get their own mapping.
+/// @return Pointer to the block, NULL on failure.
+void* arena_alloc_block(struct SharedArena* arena, size_t size);
+
+/// Releases a block from arena_alloc_block.
+/// @param size Size the block was allocated with.
+void arena_free_block(struct SharedArena* arena, void* block, size_t size);
+
+/// Initializes a lock, shared between processes when it lives in an arena.
+/// @return 0 if the lock was initialized successfully, an error number otherwise.
+int arena_rwlock_init(struct SharedArena* arena, pthread_rwlock_t* rwlock);
+
+/// Initializes a mutex and a condition variable used with it, shared between processes when they live in an arena.
+/// @return 0 if both were initialized successfully, an error number otherwise.
+int arena_cond_init(struct SharedArena* arena, pthread_mutex_t* mutex, pthread_cond_t* cond);
+
+#endif  // EMS_SHARED_H
@@ -0,0 +1,204 @@
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int stats_enabled = 0;
+
+static _Thread_local struct ThreadStats *current_stats = NULL;
+
+static const char *command_names[STATS_NUM_COMMANDS] = {
+    [CMD_CREATE] = "CREATE", [CMD_RESERVE] = "RESERVE", [CMD_SHOW] = "SHOW",     [CMD_LIST_EVENTS] = "LIST",
+    [CMD_BARRIER] = "BARRIER", [CMD_WAIT] = "WAIT",     [CMD_HELP] = "HELP",     [CMD_EMPTY] = "EMPTY",
+    [CMD_INVALID] = "INVALID", [EOC] = "EOC",
+};
+
+static const char *lock_names[STATS_NUM_LOCKS] = {
+    [STATS_LOCK_CREATE] = "create_lock",
+    [STATS_LOCK_RESERVE] = "event_reserve_lock",
+    [STATS_LOCK_SHOW] = "event_show_fallback",
+    [STATS_LOCK_CLAIM] = "tentative_seat",
+    [STATS_LOCK_DIRECTORY] = "directory_epoch",
+    [STATS_LOCK_OUTPUT] = "output_mutex",
+    [STATS_LOCK_BARRIER] = "barrier",
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/// Finds the histogram bucket of a duration: exact below 16ns, then 16 steps per power of two.
+static size_t bucket_of(uint64_t ns) {
+  if (ns < STATS_SUB_BUCKETS) return (size_t)ns;
+
+  unsigned int shift = (unsigned int)(63 - __builtin_clzll(ns)) - 4;
+  return (size_t)(shift + 1) * STATS_SUB_BUCKETS + (size_t)((ns >> shift) - STATS_SUB_BUCKETS);
+}
+
+/// Highest duration that falls in a bucket.
+static uint64_t bucket_limit(size_t bucket) {
+  if (bucket < STATS_SUB_BUCKETS) return bucket;
+
+  unsigned int shift = (unsigned int)(bucket / STATS_SUB_BUCKETS) - 1;
+  uint64_t sub = bucket % STATS_SUB_BUCKETS;
+  return ((STATS_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+static void record(struct LatencyHistogram *histogram, uint64_t ns) {
+  histogram->counts[bucket_of(ns)]++;
+  histogram->total++;
+  histogram->sum_ns += ns;
+  if (ns > histogram->max_ns) histogram->max_ns = ns;
+}
+
+void stats_attach(struct ThreadStats *stats) { current_stats = stats; }
+
+uint64_t stats_clock(void) { return stats_enabled ? now_ns() : 0; }
+
+void stats_command(enum Command type, uint64_t start) {
+  if (current_stats == NULL) return;
+  record(&current_stats->commands[type], now_ns() - start);
+}
+
+void stats_commands(enum Command type, uint64_t start, size_t count) {
+  if (current_stats == NULL) return;
+
+  uint64_t share = (now_ns() - start) / count;
+  for (size_t i = 0; i < count; i++) {
+    record(&current_stats->commands[type], share);
+  }
+}
+
+void stats_lock_wait(enum StatsLock lock, uint64_t start) {
+  if (current_stats == NULL) return;
+
+  uint64_t ns = now_ns() - start;
+  current_stats->lock_wait_ns[lock] += ns;
+  current_stats->lock_acquisitions[lock]++;
+  if (ns > current_stats->lock_max_ns[lock]) current_stats->lock_max_ns[lock] = ns;
+}
+
+void stats_seat_conflict(void) {
+  if (current_stats != NULL) current_stats->seat_conflicts++;
+}
+
+void stats_show_retry(void) {
+  if (current_stats != NULL) current_stats->show_retries++;
+}
+
+int stats_rdlock(pthread_rwlock_t *rwlock, enum StatsLock lock) {
+  uint64_t start = stats_clock();
+  int result = pthread_rwlock_rdlock(rwlock);
+  stats_lock_wait(lock, start);
+  return result;
+}
+
+int stats_wrlock(pthread_rwlock_t *rwlock, enum StatsLock lock) {
+  uint64_t start = stats_clock();
+  int result = pthread_rwlock_wrlock(rwlock);
+  stats_lock_wait(lock, start);
+  return result;
+}
+
+int stats_mutex_lock(pthread_mutex_t *mutex, enum StatsLock lock) {
+  uint64_t start = stats_clock();
+  int result = pthread_mutex_lock(mutex);
+  stats_lock_wait(lock, start);
+  return result;
+}
+
+int stats_barrier_wait(pthread_barrier_t *barrier) {
+  uint64_t start = stats_clock();
+  int result = pthread_barrier_wait(barrier);
+  stats_lock_wait(STATS_LOCK_BARRIER, start);
+  return result;
+}
+
+void stats_merge(struct ThreadStats *into, struct ThreadStats *from) {
+  for (size_t c = 0; c < STATS_NUM_COMMANDS; c++) {
+    struct LatencyHistogram *a = &into->commands[c], *b = &from->commands[c];
+    if (b->total == 0) continue;
+
+    for (size_t i = 0; i < STATS_NUM_BUCKETS; i++) a->counts[i] += b->counts[i];
+    a->total += b->total;
+    a->sum_ns += b->sum_ns;
+    if (b->max_ns > a->max_ns) a->max_ns = b->max_ns;
+  }
+
+  for (size_t l = 0; l < STATS_NUM_LOCKS; l++) {
+    into->lock_wait_ns[l] += from->lock_wait_ns[l];
+    into->lock_acquisitions[l] += from->lock_acquisitions[l];
+    if (from->lock_max_ns[l] > into->lock_max_ns[l]) into->lock_max_ns[l] = from->lock_max_ns[l];
+  }
+  into->seat_conflicts += from->seat_conflicts;
+  into->show_retries += from->show_retries;
+  into->compile_ns += from->compile_ns;
+}
+
+/// Smallest duration that is above the given fraction of the samples.
+static uint64_t percentile(struct LatencyHistogram *histogram, double fraction) {
+  uint64_t rank = (uint64_t)(fraction * (double)histogram->total);
+  if (rank >= histogram->total) rank = histogram->total - 1;
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < STATS_NUM_BUCKETS; i++) {
+    seen += histogram->counts[i];
+    if (seen > rank) {
+      uint64_t limit = bucket_limit(i);
+      return limit < histogram->max_ns ? limit : histogram->max_ns;
+    }
+  }
+  return histogram->max_ns;
+}
+
+int stats_write(const char *pathOut, struct ThreadStats *stats) {
+  size_t len = strlen(pathOut);
+  if (len >= 4 && strcmp(pathOut + len - 4, ".out") == 0) len -= 4;
+
+  char *pathStats = malloc(len + strlen(".stats") + 1);
+  if (pathStats == NULL) {
+    fprintf(stderr, "Error: Failed to allocate memory\n");
+    return 1;
+  }
+  memcpy(pathStats, pathOut, len);
+  strcpy(pathStats + len, ".stats");
+
+  FILE *file = fopen(pathStats, "w");
+  if (file == NULL) {
+    perror("Error opening stats file");
+    free(pathStats);
+    return 1;
+  }
+
+  fprintf(file, "command count mean_ns p50_ns p90_ns p99_ns p999_ns max_ns\n");
+  for (size_t c = 0; c < STATS_NUM_COMMANDS; c++) {
+    struct LatencyHistogram *histogram = &stats->commands[c];
+    if (histogram->total == 0) continue;
+
+    fprintf(file, "%s %lu %lu %lu %lu %lu %lu %lu\n", command_names[c], (unsigned long)histogram->total,
+            (unsigned long)(histogram->sum_ns / histogram->total), (unsigned long)percentile(histogram, 0.5),
+            (unsigned long)percentile(histogram, 0.9), (unsigned long)percentile(histogram, 0.99),
+            (unsigned long)percentile(histogram, 0.999), (unsigned long)histogram->max_ns);
+  }
+
+  fprintf(file, "\nlock acquisitions wait_ns max_wait_ns\n");
+  for (size_t l = 0; l < STATS_NUM_LOCKS; l++) {
+    fprintf(file, "%s %lu %lu %lu\n", lock_names[l], (unsigned long)stats->lock_acquisitions[l],
+            (unsigned long)stats->lock_wait_ns[l], (unsigned long)stats->lock_max_ns[l]);
+  }
+
+  fprintf(file, "\nseat_conflicts %lu\nshow_seqlock_retries %lu\ncompile_ns %lu\n", (unsigned long)stats->seat_conflicts,
+          (unsigned long)stats->show_retries, (unsigned long)stats->compile_ns);
+
+  int result = 0;
+  if (fclose(file) != 0) {
+    perror("Error writing stats file");
+    result = 1;
+  }
+  free(pathStats);
+  return result;
+}
@@ -0,0 +1,81 @@
+#ifndef EMS_STATS_H
+#define EMS_STATS_H
+
+#include "parser.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define STATS_SUB_BUCKETS 16                           // Linear steps inside each power of two
+#define STATS_NUM_BUCKETS (STATS_SUB_BUCKETS * 61)     // Enough to hold any 64 bit duration
+#define STATS_NUM_COMMANDS (EOC + 1)
+
+/// Locks and other waits whose time is accounted.
+enum StatsLock {
+  STATS_LOCK_CREATE,     /// Lock serializing the CREATEs.
+  STATS_LOCK_RESERVE,    /// Event lock held for reading by RESERVE batches, only contended by SHOW fallbacks.
+  STATS_LOCK_SHOW,       /// Event lock held for writing by a SHOW whose lock free copies kept failing.
+  STATS_LOCK_CLAIM,      /// Wait for a seat tentatively claimed by another reservation to be committed or freed.
+  STATS_LOCK_DIRECTORY,  /// Wait for the lookups still reading a replaced id table after a CREATE grew it.
+  STATS_LOCK_OUTPUT,     /// Mutex that orders the output flushes.
+  STATS_LOCK_BARRIER,    /// Barrier at the end of each segment.
+  STATS_NUM_LOCKS
+};
+
+/// Log-linear latency histogram in nanoseconds, with a relative error of at most 1/16.
+struct LatencyHistogram {
+  uint64_t counts[STATS_NUM_BUCKETS];
+  uint64_t total;
+  uint64_t sum_ns;
+  uint64_t max_ns;
+};
+
+/// Counters of one thread, only ever written by that thread.
+struct ThreadStats {
+  struct LatencyHistogram commands[STATS_NUM_COMMANDS];  /// Latency of each command type.
+  uint64_t lock_wait_ns[STATS_NUM_LOCKS];
+  uint64_t lock_max_ns[STATS_NUM_LOCKS];
+  uint64_t lock_acquisitions[STATS_NUM_LOCKS];
+  uint64_t seat_conflicts;                               /// Seats found taken by a RESERVE.
+  uint64_t show_retries;                                 /// SHOW copies redone because the sequence lock moved.
+  uint64_t compile_ns;                                   /// Time spent compiling the job file.
+};
+
+/// Whether instrumentation is on, set from the command line before any file is processed.
+extern int stats_enabled;
+
+/// Makes the calling thread record into the given counters, NULL to stop recording.
+void stats_attach(struct ThreadStats *stats);
+
+/// Current time in nanoseconds, or 0 when statistics are off.
+uint64_t stats_clock(void);
+
+/// Records the latency of a command started at the given stats_clock value.
+void stats_command(enum Command type, uint64_t start);
+
+/// Records a batch of commands of one type started at the given stats_clock value, each taking an equal share.
+void stats_commands(enum Command type, uint64_t start, size_t count);
+
+/// Records a wait for a lock started at the given stats_clock value.
+void stats_lock_wait(enum StatsLock lock, uint64_t start);
+
+/// Counts a seat a RESERVE found already taken.
+void stats_seat_conflict(void);
+
+/// Counts a SHOW copy of the seats that has to be redone.
+void stats_show_retry(void);
+
+/// Lock wrappers that account the time spent waiting.
+int stats_rdlock(pthread_rwlock_t *rwlock, enum StatsLock lock);
+int stats_wrlock(pthread_rwlock_t *rwlock, enum StatsLock lock);
+int stats_mutex_lock(pthread_mutex_t *mutex, enum StatsLock lock);
+int stats_barrier_wait(pthread_barrier_t *barrier);
+
+/// Adds the counters of one thread to another.
+void stats_merge(struct ThreadStats *into, struct ThreadStats *from);
+
+/// Writes a report of the counters next to an output file, replacing its .out extension with .stats.
+/// @return 0 if the report was written successfully, 1 otherwise.
+int stats_write(const char *pathOut, struct ThreadStats *stats);
+
+#endif  // EMS_STATS_H
@@ -0,0 +1,77 @@
+#!/bin/sh
+# Runs the regression cases under tests/ and diffs their outputs against the expected ones.
+#
+# Each case is a directory with:
+#   *.jobs     the job files, copied to a scratch directory before running
+#   generate   optional; script that writes job files too large to keep into the directory it is given
+#   args       the ems arguments on one line, with @ standing for the scratch directory, e.g. "-e @ 1 4 0"
+#   compile    optional; when present the job files are compiled with jobc and only the .jobc files run
+#   timeout    optional; seconds the run may take, for cases that guard against slowdowns
+#   expected/  the expected .out files, and/or an md5 file (md5sum format) for outputs too large to keep
+#   check      optional; script given the scratch directory that checks outputs which vary between runs
+#
+# Usage: tests/run.sh [case...]   (from the directory with ems and jobc)
+
+cd "$(dirname "$0")/.." || exit 1
+TIMEOUT=${TEST_TIMEOUT:-120}
+
+if [ $# -eq 0 ]; then
+  set -- tests/*/
+fi
+
+failed=0
+for case in "$@"; do
+  case=${case%/}
+  name=$(basename "$case")
+  work=$(mktemp -d) || exit 1
+
+  ok=1
+  if [ -f "$case/generate" ]; then
+    sh "$case/generate" "$work" || ok=0
+  else
+    cp "$case"/*.jobs "$work"/
+  fi
+
+  if [ -f "$case/compile" ]; then
+    ./jobc "$work"/*.jobs >/dev/null && rm -f "$work"/*.jobs || ok=0
+  fi
+
+  limit=$TIMEOUT
+  [ -f "$case/timeout" ] && limit=$(cat "$case/timeout")
+
+  args=$(sed "s|@|$work|" "$case/args")
+  # shellcheck disable=SC2086
+  if [ $ok = 1 ] && ! timeout "$limit" ./ems $args >"$work/stdout" 2>"$work/stderr"; then
+    echo "$name: ems failed or timed out"
+    ok=0
+  fi
+
+  if [ $ok = 1 ]; then
+    for expected in "$case"/expected/*.out; do
+      [ -f "$expected" ] || continue
+      out="$work/$(basename "$expected")"
+      if ! diff -u "$expected" "$out" >"$work/diff" 2>&1; then
+        echo "$name: $(basename "$expected") differs"
+        head -20 "$work/diff"
+        ok=0
+      fi
+    done
+    if [ -f "$case/expected/md5" ] && ! (cd "$work" && md5sum --quiet -c) <"$case/expected/md5"; then
+      echo "$name: checksums differ"
+      ok=0
+    fi
+    if [ -f "$case/check" ] && ! sh "$case/check" "$work"; then
+      echo "$name: check failed"
+      ok=0
+    fi
+  fi
+
+  if [ $ok = 1 ]; then
+    echo "$name: ok"
+  else
+    failed=$((failed + 1))
+  fi
+  rm -rf "$work"
+done
+
+[ $failed = 0 ] || { echo "$failed case(s) failed"; exit 1; }